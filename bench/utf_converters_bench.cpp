@@ -0,0 +1,613 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ww898/utf_converters.hpp>
+#include <ww898/utf_batch.hpp>
+#include <ww898/utf_offsets.hpp>
+#include <ww898/utf_pipeline.hpp>
+#include <ww898/utf_fanout.hpp>
+#include <ww898/utf_streaming.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ww898 {
+namespace bench {
+
+namespace {
+
+enum struct corpus { ascii, latin, cyrillic, cjk, emoji, mixed };
+
+char const * const corpus_names[] = { "ascii", "latin", "cyrillic", "cjk", "emoji", "mixed" };
+
+corpus const corpora[] = { corpus::ascii, corpus::latin, corpus::cyrillic, corpus::cjk, corpus::emoji, corpus::mixed };
+
+// Note: Sizes are in UTF8 bytes, the other encodings hold the same code points.
+size_t const corpus_sizes[] = { 16, 256, 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+
+char32_t const latin_letters[] =
+{
+    0x00E0, 0x00E1, 0x00E2, 0x00E4, 0x00E7, 0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00ED, 0x00EE, 0x00EF,
+    0x00F1, 0x00F3, 0x00F4, 0x00F6, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00DF, 0x0153, 0x0161, 0x017E
+};
+
+size_t utf8_size(char32_t const cp)
+{
+    return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+}
+
+class generator final
+{
+public:
+    generator(corpus const kind, size_t const size)
+        : kind_(kind)
+        , size_(size)
+        , random_(static_cast<std::mt19937::result_type>(kind) + 1)
+    {}
+
+    std::u32string operator()()
+    {
+        std::u32string u32;
+        size_t u8_size = 0;
+        std::u32string token;
+        while (true)
+        {
+            token.clear();
+            append_token(kind_, token);
+            for (auto const cp : token)
+            {
+                auto const cp_size = utf8_size(cp);
+                if (u8_size + cp_size > size_)
+                    return u32;
+                u32.push_back(cp);
+                u8_size += cp_size;
+            }
+        }
+    }
+
+private:
+    size_t uniform(size_t const min, size_t const max)
+    {
+        return std::uniform_int_distribution<size_t>(min, max)(random_);
+    }
+
+    bool chance(size_t const percents)
+    {
+        return uniform(1, 100) <= percents;
+    }
+
+    void append_ascii(std::u32string & token, char const * const str)
+    {
+        for (auto ptr = str; *ptr; ++ptr)
+            token.push_back(static_cast<char32_t>(*ptr));
+    }
+
+    void append_separator(std::u32string & token)
+    {
+        if (chance(5))
+            token.push_back('\n');
+        else if (chance(10))
+            append_ascii(token, ". ");
+        else if (chance(10))
+            append_ascii(token, ", ");
+        else
+            token.push_back(' ');
+    }
+
+    void append_token(corpus const kind, std::u32string & token)
+    {
+        switch (kind)
+        {
+        case corpus::ascii:
+            for (auto n = uniform(1, 10); n-- > 0;)
+                token.push_back(static_cast<char32_t>(uniform('a', 'z')));
+            append_separator(token);
+            break;
+
+        case corpus::latin:
+            for (auto n = uniform(1, 10); n-- > 0;)
+                token.push_back(chance(15)
+                    ? latin_letters[uniform(0, sizeof(latin_letters) / sizeof(*latin_letters) - 1)]
+                    : static_cast<char32_t>(uniform('a', 'z')));
+            append_separator(token);
+            break;
+
+        case corpus::cyrillic:
+            for (auto n = uniform(1, 10); n-- > 0;)
+                token.push_back(static_cast<char32_t>(uniform(0x0430, 0x044F)));
+            append_separator(token);
+            break;
+
+        case corpus::cjk:
+            for (auto n = uniform(4, 20); n-- > 0;)
+                token.push_back(static_cast<char32_t>(uniform(0x4E00, 0x9FFF)));
+            if (chance(10))
+                token.push_back('\n');
+            else
+                token.push_back(chance(50) ? 0x3001 : 0x3002);
+            break;
+
+        case corpus::emoji:
+            append_token(corpus::ascii, token);
+            if (chance(30))
+            {
+                token.push_back(static_cast<char32_t>(uniform(0x1F300, 0x1F64F)));
+                token.push_back(' ');
+            }
+            break;
+
+        case corpus::mixed:
+            if (chance(50))
+            {
+                append_ascii(token, "{ \"id\": ");
+                for (auto n = uniform(1, 8); n-- > 0;)
+                    token.push_back(static_cast<char32_t>(uniform('0', '9')));
+                append_ascii(token, ", \"name\": \"");
+                for (auto n = uniform(1, 3); n-- > 0;)
+                    append_token(corpora[uniform(0, 4)], token);
+                append_ascii(token, "\" },\n");
+            }
+            else
+            {
+                append_ascii(token, "    if (value != nullptr && ");
+                append_token(corpus::ascii, token);
+                append_ascii(token, ")\n        return value->size();\n");
+            }
+            break;
+        }
+    }
+
+    corpus const kind_;
+    size_t const size_;
+    std::mt19937 random_;
+};
+
+struct corpus_data final
+{
+    std::string    u8 ;
+    std::u16string u16;
+    std::u32string u32;
+    std::wstring   uw ;
+};
+
+std::string    const & select(corpus_data const & data, char    ) { return data.u8 ; }
+std::u16string const & select(corpus_data const & data, char16_t) { return data.u16; }
+std::u32string const & select(corpus_data const & data, char32_t) { return data.u32; }
+std::wstring   const & select(corpus_data const & data, wchar_t ) { return data.uw ; }
+
+// Note: Benchmarks are registered grouped by corpus and size, so only the last data is kept to bound the memory.
+corpus_data const & load_corpus(corpus const kind, size_t const size)
+{
+    static corpus kind_cache;
+    static size_t size_cache = 0;
+    static corpus_data data_cache;
+    if (size_cache != size || kind_cache != kind)
+    {
+        data_cache = corpus_data();
+        data_cache.u32 = generator(kind, size)();
+        utf::conv<utf::utf32, utf::utf8 >(data_cache.u32.cbegin(), data_cache.u32.cend(), std::back_inserter(data_cache.u8 ));
+        utf::conv<utf::utf32, utf::utf16>(data_cache.u32.cbegin(), data_cache.u32.cend(), std::back_inserter(data_cache.u16));
+        utf::conv<utf::utf32, utf::utfw >(data_cache.u32.cbegin(), data_cache.u32.cend(), std::back_inserter(data_cache.uw ));
+        kind_cache = kind;
+        size_cache = size;
+    }
+    return data_cache;
+}
+
+template<
+    typename Ch>
+struct utf_namer {};
+
+template<> struct utf_namer<char    > { static char const * name() { return "UTF8" ; } };
+template<> struct utf_namer<char16_t> { static char const * name() { return "UTF16"; } };
+template<> struct utf_namer<char32_t> { static char const * name() { return "UTF32"; } };
+template<> struct utf_namer<wchar_t > { static char const * name() { return "UTFW" ; } };
+
+template<
+    typename Ch,
+    typename Och>
+void bench_conv(benchmark::State & state, corpus const kind, size_t const size)
+{
+    typedef utf::utf_selector_t<Ch> utf_type;
+    typedef utf::utf_selector_t<Och> outf_type;
+
+    auto const & data = load_corpus(kind, size);
+    auto const & buf = select(data, Ch());
+    auto const & obuf = select(data, Och());
+
+    std::vector<Och> res(obuf.size() + 1);
+    auto const beg = buf.data();
+    auto const end = beg + buf.size();
+    for (auto _ : state)
+    {
+        auto const oend = utf::conv<utf_type, outf_type>(beg, end, res.data());
+        benchmark::DoNotOptimize(oend);
+        benchmark::ClobberMemory();
+    }
+
+    if (!std::equal(obuf.cbegin(), obuf.cend(), res.cbegin()))
+        state.SkipWithError("Conversion result mismatch");
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sizeof(Ch) * buf.size()));
+    state.counters["code_points"] = benchmark::Counter(
+        static_cast<double>(data.u32.size()),
+        benchmark::Counter::kIsIterationInvariantRate);
+}
+
+template<
+    typename Ch,
+    typename Och>
+void register_conv(corpus const kind, size_t const size)
+{
+    auto const name =
+        std::string(utf_namer<Ch>::name()) + "_to_" + utf_namer<Och>::name() + "/" +
+        corpus_names[static_cast<size_t>(kind)] + "/" + std::to_string(size);
+    benchmark::RegisterBenchmark(name.c_str(), [kind, size] (benchmark::State & state)
+        {
+            bench_conv<Ch, Och>(state, kind, size);
+        });
+}
+
+template<
+    typename Ch>
+void register_conv_from(corpus const kind, size_t const size)
+{
+    register_conv<Ch, char    >(kind, size);
+    register_conv<Ch, char16_t>(kind, size);
+    register_conv<Ch, char32_t>(kind, size);
+    register_conv<Ch, wchar_t >(kind, size);
+}
+
+// Note: The string overload appends to the result by std::back_inserter, which is converted by chunks.
+void bench_string(benchmark::State & state, corpus const kind)
+{
+    static size_t const size = 64 * 1024;
+    auto const & u16 = load_corpus(kind, size).u16;
+    for (auto _ : state)
+    {
+        auto const res = utf::conv<char>(u16);
+        benchmark::DoNotOptimize(res.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sizeof(char16_t) * u16.size()));
+}
+
+void register_string(corpus const kind)
+{
+    auto const name = std::string("String_UTF16_to_UTF8/") + corpus_names[static_cast<size_t>(kind)];
+    benchmark::RegisterBenchmark(name.c_str(), [kind] (benchmark::State & state)
+        {
+            bench_string(state, kind);
+        });
+}
+
+void bench_unchecked(benchmark::State & state, corpus const kind)
+{
+    static size_t const size = 64 * 1024;
+    auto const & u8 = load_corpus(kind, size).u8;
+    std::vector<char16_t> buf(u8.size());
+    for (auto _ : state)
+    {
+        auto const oit = utf::conv_unchecked<utf::utf8, utf::utf16>(u8.data(), u8.data() + u8.size(), buf.data());
+        benchmark::DoNotOptimize(oit);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(u8.size()));
+}
+
+void register_unchecked(corpus const kind)
+{
+    auto const name = std::string("Unchecked_UTF8_to_UTF16/") + corpus_names[static_cast<size_t>(kind)];
+    benchmark::RegisterBenchmark(name.c_str(), [kind] (benchmark::State & state)
+        {
+            bench_unchecked(state, kind);
+        });
+}
+
+// Note: The LSP positions are UTF16 columns in the UTF8 text, the whole text is scanned to find the last one.
+void bench_offset(benchmark::State & state, corpus const kind, size_t const size)
+{
+    auto const & data = load_corpus(kind, size);
+    auto const & u8 = data.u8;
+    auto const u16_size = data.u16.size();
+    for (auto _ : state)
+    {
+        auto const offset = utf::conv_offset<utf::utf8, utf::utf16, utf::utf8>(u8.data(), u8.data() + u8.size(), u16_size);
+        benchmark::DoNotOptimize(offset);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(u8.size()));
+}
+
+void register_offset(corpus const kind)
+{
+    for (auto const size : { size_t(256), size_t(64 * 1024) })
+    {
+        auto const name =
+            std::string("Offset_UTF16_to_UTF8/") + corpus_names[static_cast<size_t>(kind)] + "/" + std::to_string(size);
+        benchmark::RegisterBenchmark(name.c_str(), [kind, size] (benchmark::State & state)
+            {
+                bench_offset(state, kind, size);
+            });
+    }
+}
+
+// Note: The two pass variant converts to UTF8 first and escapes the result like a separate escaper does.
+void bench_json(benchmark::State & state, corpus const kind, bool const fused)
+{
+    static size_t const size = 1024 * 1024;
+    auto const & u16 = load_corpus(kind, size).u16;
+    std::string u8;
+    std::vector<char> res(u16.size() * utf::utf8_json::max_supported_symbol_size);
+    for (auto _ : state)
+    {
+        char * oend;
+        if (fused)
+            oend = utf::conv<utf::utf16, utf::utf8_json>(u16.data(), u16.data() + u16.size(), res.data());
+        else
+        {
+            u8.clear();
+            utf::conv<utf::utf16, utf::utf8>(u16.data(), u16.data() + u16.size(), std::back_inserter(u8));
+            oend = utf::conv<utf::utf8, utf::utf8_json>(u8.data(), u8.data() + u8.size(), res.data());
+        }
+        benchmark::DoNotOptimize(oend);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(sizeof(char16_t) * u16.size()));
+}
+
+void register_json(corpus const kind)
+{
+    for (auto const fused : { false, true })
+    {
+        auto const name =
+            std::string("Json_UTF16_to_UTF8/") + corpus_names[static_cast<size_t>(kind)] + "/" +
+            (fused ? "fused" : "two_pass");
+        benchmark::RegisterBenchmark(name.c_str(), [kind, fused] (benchmark::State & state)
+            {
+                bench_json(state, kind, fused);
+            });
+    }
+}
+
+// Note: The two pass variant decodes the UTF8 text for every output.
+void bench_fanout(benchmark::State & state, corpus const kind, bool const fused)
+{
+    static size_t const size = 1024 * 1024;
+    auto const & u8 = load_corpus(kind, size).u8;
+    std::vector<char16_t> u16(u8.size());
+    std::vector<char32_t> u32(u8.size());
+    for (auto _ : state)
+    {
+        if (fused)
+            utf::conv_fanout<utf::utf8, utf::utf16, utf::utf32>(u8.data(), u8.data() + u8.size(), u16.data(), u32.data());
+        else
+        {
+            utf::conv<utf::utf8, utf::utf16>(u8.data(), u8.data() + u8.size(), u16.data());
+            utf::conv<utf::utf8, utf::utf32>(u8.data(), u8.data() + u8.size(), u32.data());
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(u8.size()));
+}
+
+void register_fanout(corpus const kind)
+{
+    for (auto const fused : { false, true })
+    {
+        auto const name =
+            std::string("Fanout_UTF8_to_UTF16_UTF32/") + corpus_names[static_cast<size_t>(kind)] + "/" +
+            (fused ? "fused" : "two_pass");
+        benchmark::RegisterBenchmark(name.c_str(), [kind, fused] (benchmark::State & state)
+            {
+                bench_fanout(state, kind, fused);
+            });
+    }
+}
+
+// Note: The victim is the working set of the other work on the core, it is read before and after every conversion.
+//       The time of the second read shows how much of it the conversion evicted from the caches.
+void bench_streaming(benchmark::State & state, corpus const kind, bool const streaming)
+{
+    static size_t const size = 64 * 1024 * 1024;
+    static size_t const victim_size = 1024 * 1024;
+    auto const & u8 = load_corpus(kind, size).u8;
+    std::vector<char16_t> u16(u8.size());
+    std::vector<uint64_t> victim(victim_size / sizeof(uint64_t), 1);
+    auto const read_victim = [&victim]
+        {
+            uint64_t sum = 0;
+            for (auto const value : victim)
+                sum += value;
+            benchmark::DoNotOptimize(sum);
+        };
+    std::chrono::steady_clock::duration victim_duration{};
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        read_victim();
+        state.ResumeTiming();
+        if (streaming)
+            utf::conv_streaming<utf::utf8, utf::utf16>(u8.data(), u8.data() + u8.size(), u16.data(), 0);
+        else
+            utf::conv<utf::utf8, utf::utf16>(u8.data(), u8.data() + u8.size(), u16.data());
+        benchmark::ClobberMemory();
+        state.PauseTiming();
+        auto const beg_time = std::chrono::steady_clock::now();
+        read_victim();
+        victim_duration += std::chrono::steady_clock::now() - beg_time;
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(u8.size()));
+    state.counters["victim_reload_us"] = benchmark::Counter(
+        std::chrono::duration<double, std::micro>(victim_duration).count() / static_cast<double>(state.iterations()));
+}
+
+void register_streaming(corpus const kind)
+{
+    for (auto const streaming : { false, true })
+    {
+        auto const name =
+            std::string("Streaming_UTF8_to_UTF16/") + corpus_names[static_cast<size_t>(kind)] + "/" +
+            (streaming ? "streaming" : "cached");
+        benchmark::RegisterBenchmark(name.c_str(), [kind, streaming] (benchmark::State & state)
+            {
+                bench_streaming(state, kind, streaming);
+            });
+    }
+}
+
+// Note: The corpus is split by spaces into many short strings like the values of a text column.
+std::vector<std::u16string> split_words(std::u16string const & u16)
+{
+    std::vector<std::u16string> words;
+    size_t beg = 0;
+    for (size_t end; (end = u16.find(u' ', beg)) != std::u16string::npos; beg = end + 1)
+        words.emplace_back(u16, beg, end - beg);
+    words.emplace_back(u16, beg, std::u16string::npos);
+    return words;
+}
+
+void bench_batch(benchmark::State & state, corpus const kind, bool const column)
+{
+    static size_t const size = 1024 * 1024;
+    auto const words = split_words(load_corpus(kind, size).u16);
+    for (auto _ : state)
+    {
+        if (column)
+        {
+            auto const res = utf::conv_batch<char>(words.cbegin(), words.cend());
+            benchmark::DoNotOptimize(res.data.data());
+        }
+        else
+        {
+            std::vector<std::string> res;
+            res.reserve(words.size());
+            for (auto const & word : words)
+                res.push_back(utf::conv<char>(word));
+            benchmark::DoNotOptimize(res.data());
+        }
+        benchmark::ClobberMemory();
+    }
+    state.counters["strings"] = benchmark::Counter(
+        static_cast<double>(words.size()),
+        benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void register_batch(corpus const kind)
+{
+    for (auto const column : { false, true })
+    {
+        auto const name =
+            std::string("Batch_UTF16_to_UTF8/") + corpus_names[static_cast<size_t>(kind)] + "/" +
+            (column ? "column" : "per_string");
+        benchmark::RegisterBenchmark(name.c_str(), [kind, column] (benchmark::State & state)
+            {
+                bench_batch(state, kind, column);
+            });
+    }
+}
+
+// Note: Zero workers means the single threaded loop which reads, converts and writes every block in turn.
+void bench_pipeline(benchmark::State & state, corpus const kind, size_t const worker_count)
+{
+    static size_t const size = 16 * 1024 * 1024;
+    auto const & u8 = load_corpus(kind, size).u8;
+    std::vector<char16_t> block(utf::default_pipeline_block_size);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::stringbuf ibuf(u8);
+        std::basic_stringbuf<char16_t> obuf;
+        state.ResumeTiming();
+        if (worker_count != 0)
+            utf::conv_pipeline<utf::utf8, utf::utf16>(ibuf, obuf, worker_count);
+        else
+        {
+            utf::transcoding_streambuf_u16 tbuf(&ibuf, utf::default_pipeline_block_size);
+            for (std::streamsize read; (read = tbuf.sgetn(block.data(), static_cast<std::streamsize>(block.size()))) > 0;)
+                obuf.sputn(block.data(), read);
+        }
+        benchmark::DoNotOptimize(obuf.in_avail());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(u8.size()));
+}
+
+void register_pipeline(corpus const kind)
+{
+    for (auto const worker_count : { size_t(0), size_t(1), size_t(2), size_t(4) })
+    {
+        auto const name =
+            std::string("Pipeline_UTF8_to_UTF16/") + corpus_names[static_cast<size_t>(kind)] + "/workers:" +
+            std::to_string(worker_count);
+        benchmark::RegisterBenchmark(name.c_str(), [kind, worker_count] (benchmark::State & state)
+            {
+                bench_pipeline(state, kind, worker_count);
+            })->UseRealTime();
+    }
+}
+
+void register_benchmarks()
+{
+    for (auto const kind : corpora)
+    {
+        register_string(kind);
+        register_unchecked(kind);
+        register_offset(kind);
+        register_json(kind);
+        register_fanout(kind);
+        register_streaming(kind);
+        register_pipeline(kind);
+    }
+
+    for (auto const kind : corpora)
+        register_batch(kind);
+
+    for (auto const kind : corpora)
+        for (auto const size : corpus_sizes)
+        {
+            register_conv_from<char    >(kind, size);
+            register_conv_from<char16_t>(kind, size);
+            register_conv_from<char32_t>(kind, size);
+            register_conv_from<wchar_t >(kind, size);
+        }
+}
+
+}
+
+}}
+
+// Note: Use --benchmark_format=json or --benchmark_out=<file> for the JSON report.
+int main(int argc, char * argv[])
+{
+    ww898::bench::register_benchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
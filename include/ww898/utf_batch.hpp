@@ -0,0 +1,169 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <vector>
+
+#if __cpp_lib_string_view >= 201606
+#include <string_view>
+#endif
+
+namespace ww898 {
+namespace utf {
+
+// Note: Arrow style column of strings: the string i occupies [data[offsets[i]]‥data[offsets[i + 1]]), so the offsets
+//       hold one more element than the strings. All the strings share one buffer without terminating zeros.
+template<
+    typename Och>
+struct basic_string_column final
+{
+    typedef Och char_type;
+
+    std::vector<Och> data;
+    std::vector<size_t> offsets;
+
+    size_t size() const throw()
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    Och const * begin(size_t const n) const throw()
+    {
+        return data.data() + offsets[n];
+    }
+
+    Och const * end(size_t const n) const throw()
+    {
+        return data.data() + offsets[n + 1];
+    }
+
+    std::basic_string<Och> str(size_t const n) const
+    {
+        return std::basic_string<Och>(begin(n), end(n));
+    }
+
+#if __cpp_lib_string_view >= 201606
+    std::basic_string_view<Och> operator[](size_t const n) const throw()
+    {
+        return std::basic_string_view<Och>(begin(n), offsets[n + 1] - offsets[n]);
+    }
+#endif
+};
+
+namespace detail {
+
+template<
+    typename Utf,
+    typename Outf,
+    typename Och,
+    typename RangeFn>
+void conv_batch(size_t const count, RangeFn && range_fn, basic_string_column<Och> & column)
+{
+    auto & offsets = column.offsets;
+    auto & data = column.data;
+    auto const base_count = offsets.size();
+    auto const base_size = data.size();
+    try
+    {
+        if (offsets.empty())
+            offsets.push_back(base_size);
+        offsets.reserve(offsets.size() + count);
+        // Note: The column is reserved once for one output code unit per input code unit, it is exact for ASCII and
+        //       grows geometrically by the appends for the longer symbols. Every string is converted by chunks in the
+        //       append buffer and copied from it to the column.
+        size_t input_size = 0;
+        for (size_t n = 0; n < count; ++n)
+        {
+            auto const range = range_fn(n);
+            input_size += static_cast<size_t>(range.second - range.first);
+        }
+        data.reserve(data.size() + input_size);
+        for (size_t n = 0; n < count; ++n)
+        {
+            auto const range = range_fn(n);
+            conv<Utf, Outf>(range.first, range.second, std::back_inserter(data));
+            offsets.push_back(data.size());
+        }
+        // Note: The place left by the geometric growth is released, the column of many strings lives long.
+        if (data.capacity() - data.size() > data.size() / 8)
+            data.shrink_to_fit();
+    }
+    catch (...)
+    {
+        offsets.resize(base_count);
+        data.resize(base_size);
+        throw;
+    }
+}
+
+}
+
+// Note: Appends the converted strings to the column, *it should have data() and size() like std::basic_string. The
+//       column is not changed when any string fails to convert.
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Och>
+void conv_batch(It const it, It const eit, basic_string_column<Och> & column)
+{
+    static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value,
+        "Random access iterator is expected");
+    detail::conv_batch<Utf, Outf>(static_cast<size_t>(eit - it), [&it] (size_t const n)
+        {
+            auto const & str = it[n];
+            return std::make_pair(str.data(), str.data() + str.size());
+        }, column);
+}
+
+// Note: Appends the strings given by Arrow style offsets and data, the offsets should hold count + 1 elements. The column
+//       is not changed when any string fails to convert.
+template<
+    typename Utf,
+    typename Outf,
+    typename Offset,
+    typename Ch,
+    typename Och>
+void conv_batch(Offset const * const offsets, size_t const count, Ch const * const data, basic_string_column<Och> & column)
+{
+    detail::conv_batch<Utf, Outf>(count, [offsets, data] (size_t const n)
+        {
+            return std::make_pair(data + offsets[n], data + offsets[n + 1]);
+        }, column);
+}
+
+template<
+    typename Och,
+    typename It>
+basic_string_column<Och> conv_batch(It const it, It const eit)
+{
+    basic_string_column<Och> column;
+    conv_batch<utf_selector_t<typename std::decay<decltype(*it->data())>::type>, utf_selector_t<Och>>(it, eit, column);
+    return column;
+}
+
+}}
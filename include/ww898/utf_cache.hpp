@@ -0,0 +1,221 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ww898 {
+namespace utf {
+
+// Note: The hits and the misses are the lookups of the short strings, the bypasses are the long strings converted
+//       without the cache, the evictions are the entries replaced by the new ones.
+struct conv_cache_stats final
+{
+    size_t hits;
+    size_t misses;
+    size_t bypasses;
+    size_t evictions;
+};
+
+// Note: Caches the conversions of the short strings which are repeated a lot, like the field names and the host names.
+//       The entries are split by the code point hash into the shards with own locks and evicted by CLOCK: the hand
+//       skips and clears the entries used since its last pass. The results are shared and immutable, so they stay
+//       valid after the eviction. The strings longer than max_input_size code units bypass the cache.
+template<
+    typename Ch,
+    typename Och>
+class conv_cache final
+{
+public:
+    typedef std::shared_ptr<std::basic_string<Och> const> result_type;
+
+    explicit conv_cache(
+        size_t const capacity = 4096,
+        size_t const shard_count = 16,
+        size_t const max_input_size = 64)
+        : shard_count_(shard_count)
+        , shard_capacity_(shard_count != 0 ? (capacity + shard_count - 1) / shard_count : 0)
+        , max_input_size_(max_input_size)
+        , shards_(shard_count != 0 ? new shard[shard_count] : nullptr)
+        , bypasses_(0)
+    {
+        if (shard_count_ == 0 || shard_capacity_ == 0)
+            throw std::invalid_argument("Empty cache");
+    }
+
+    conv_cache(conv_cache const &) = delete;
+    conv_cache & operator=(conv_cache const &) = delete;
+
+    result_type conv(Ch const * const str, size_t const size)
+    {
+        if (size > max_input_size_)
+        {
+            bypasses_.fetch_add(1, std::memory_order_relaxed);
+            return convert(str, size);
+        }
+        auto const h = hash<utf_selector_t<Ch>>(str, str + size);
+        auto & s = shards_[h % shard_count_];
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (auto const e = s.find(h, str, size))
+            {
+                ++s.hits;
+                e->referenced = true;
+                return e->value;
+            }
+            ++s.misses;
+        }
+        // Note: The conversion runs without the lock, so the other threads convert in parallel.
+        std::basic_string<Ch> key(str, size);
+        auto value = convert(str, size);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (auto const e = s.find(h, str, size))
+            return e->value;
+        s.insert(h, std::move(key), value, shard_capacity_);
+        return value;
+    }
+
+    result_type conv(std::basic_string<Ch> const & str)
+    {
+        return conv(str.data(), str.size());
+    }
+
+    conv_cache_stats stats() const
+    {
+        conv_cache_stats res = { 0, 0, bypasses_.load(std::memory_order_relaxed), 0 };
+        for (size_t n = 0; n < shard_count_; ++n)
+        {
+            auto const & s = shards_[n];
+            std::lock_guard<std::mutex> lock(s.mutex);
+            res.hits += s.hits;
+            res.misses += s.misses;
+            res.evictions += s.evictions;
+        }
+        return res;
+    }
+
+    void clear()
+    {
+        for (size_t n = 0; n < shard_count_; ++n)
+        {
+            auto & s = shards_[n];
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.entries.clear();
+            s.index.clear();
+            s.hand = 0;
+        }
+    }
+
+private:
+    struct entry final
+    {
+        size_t hash;
+        std::basic_string<Ch> key;
+        result_type value;
+        bool referenced;
+    };
+
+    // Note: The index keeps one entry per hash, the colliding string takes the place of the previous one in the index
+    //       and the previous entry waits for the eviction.
+    struct shard final
+    {
+        shard()
+            : hand(0)
+            , hits(0)
+            , misses(0)
+            , evictions(0)
+        {}
+
+        entry * find(size_t const h, Ch const * const str, size_t const size)
+        {
+            auto const it = index.find(h);
+            if (it == index.end())
+                return nullptr;
+            auto & e = entries[it->second];
+            if (e.key.size() != size || std::char_traits<Ch>::compare(e.key.data(), str, size) != 0)
+                return nullptr;
+            return &e;
+        }
+
+        void insert(size_t const h, std::basic_string<Ch> && key, result_type const & value, size_t const capacity)
+        {
+            size_t pos;
+            if (entries.size() < capacity)
+            {
+                pos = entries.size();
+                entries.push_back(entry{h, std::move(key), value, false});
+            }
+            else
+            {
+                while (entries[hand].referenced)
+                {
+                    entries[hand].referenced = false;
+                    hand = (hand + 1) % capacity;
+                }
+                pos = hand;
+                hand = (hand + 1) % capacity;
+                auto & e = entries[pos];
+                auto const it = index.find(e.hash);
+                if (it != index.end() && it->second == pos)
+                    index.erase(it);
+                ++evictions;
+                e.hash = h;
+                e.key = std::move(key);
+                e.value = value;
+                e.referenced = false;
+            }
+            index[h] = pos;
+        }
+
+        mutable std::mutex mutex;
+        std::vector<entry> entries;
+        std::unordered_map<size_t, size_t> index;
+        size_t hand;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+    };
+
+    static result_type convert(Ch const * const str, size_t const size)
+    {
+        std::basic_string<Och> res;
+        utf::conv<utf_selector_t<Ch>, utf_selector_t<Och>>(str, str + size, std::back_inserter(res));
+        return std::make_shared<std::basic_string<Och> const>(std::move(res));
+    }
+
+    size_t const shard_count_;
+    size_t const shard_capacity_;
+    size_t const max_input_size_;
+    std::unique_ptr<shard[]> shards_;
+    std::atomic<size_t> bypasses_;
+};
+
+}}
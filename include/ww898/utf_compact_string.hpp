@@ -0,0 +1,473 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <cstring>
+
+namespace ww898 {
+namespace utf {
+namespace detail {
+
+// Note: The bound is the largest code point of the storage: 0x7F, 0xFF, 0xFFFF or max_unicode_code_point. The size is
+//       the number of the code points, it is exact for the valid text and never smaller for the invalid one.
+struct compact_scan final
+{
+    uint32_t bound;
+    size_t size;
+};
+
+// Note: Takes the bits of all code units or'ed together, the powers of two are the limits of the storages.
+inline uint32_t compact_bound(uint32_t const bits) throw()
+{
+    return
+        bits < 0x80 ? 0x7F :
+        bits < 0x100 ? 0xFF :
+        bits < 0x10000 ? 0xFFFF :
+        max_unicode_code_point;
+}
+
+#if defined(WW898_UTF_SSE2)
+namespace simd {
+
+inline uint32_t reduce_max_epu8(__m128i v) throw()
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v)) & 0xFF;
+}
+
+inline uint32_t reduce_or(__m128i v) throw()
+{
+    v = _mm_or_si128(v, _mm_srli_si128(v, 8));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 4));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+
+// Note: The counts of the bytes are summed into two 64 bit lanes.
+inline size_t reduce_sum_epi64(__m128i const v) throw()
+{
+    uint64_t sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), v);
+    return static_cast<size_t>(sums[0] + sums[1]);
+}
+
+}
+#endif
+
+// Note: Finds the storage of the text in one pass over the code units without the decoding.
+template<
+    typename Utf>
+struct compact_scanner {};
+
+// Note: The master code units below 0xC4 start the code points below 0x100, the ones below 0xF0 start the code points
+//       below 0x10000, the code points are counted by the code units which are not the slave ones.
+template<>
+struct compact_scanner<utf8>
+{
+    template<
+        typename It>
+    static compact_scan scan(It it, It const eit)
+    {
+        uint32_t max_unit = 0;
+        size_t size = 0;
+        scan_blocks(it, eit, max_unit, size, is_unit_pointer<utf8, It>());
+        for (; it != eit; ++it)
+        {
+            uint8_t const ch = *it;
+            if (max_unit < ch)
+                max_unit = ch;
+            if ((ch & 0xC0) != 0x80)
+                ++size;
+        }
+        return compact_scan
+            {
+                compact_bound(max_unit < 0x80 ? max_unit : max_unit < 0xC4 ? 0xFF : max_unit < 0xF0 ? 0xFFFF : 0x10000),
+                size
+            };
+    }
+
+private:
+    template<
+        typename It>
+    static void scan_blocks(It &, It const, uint32_t &, size_t &, std::false_type) throw() {}
+
+    template<
+        typename It>
+    static void scan_blocks(It & it, It const eit, uint32_t & max_unit, size_t & size, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        if (static_cast<size_t>(eit - it) < simd::block_size)
+            return;
+        auto max = _mm_setzero_si128();
+        auto sums = _mm_setzero_si128();
+        do
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it));
+            max = _mm_max_epu8(max, v);
+            // Note: The slave code units [0x80‥0xBF] are the signed bytes below -0x40.
+            auto const masters = _mm_andnot_si128(
+                _mm_cmplt_epi8(v, _mm_set1_epi8(-0x40)),
+                _mm_set1_epi8(1));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(masters, _mm_setzero_si128()));
+            it += simd::block_size;
+        }
+        while (static_cast<size_t>(eit - it) >= simd::block_size);
+        max_unit = simd::reduce_max_epu8(max);
+        size = simd::reduce_sum_epi64(sums);
+#endif
+    }
+};
+
+template<>
+struct compact_scanner<utf8_strict> : compact_scanner<utf8> {};
+
+// Note: Any surrogate means the code points above 0xFFFF, the code points are counted by the code units which are not
+//       the trail surrogates.
+template<>
+struct compact_scanner<utf16> final
+{
+    template<
+        typename It>
+    static compact_scan scan(It it, It const eit)
+    {
+        uint32_t bits = 0;
+        size_t size = 0;
+        scan_blocks(it, eit, bits, size, is_unit_pointer<utf16, It>());
+        for (; it != eit; ++it)
+        {
+            uint16_t const ch = *it;
+            bits |= ch;
+            if ((ch & 0xF800) == 0xD800)
+                bits |= 0x10000;
+            if ((ch & 0xFC00) != 0xDC00)
+                ++size;
+        }
+        return compact_scan{compact_bound(bits), size};
+    }
+
+private:
+    template<
+        typename It>
+    static void scan_blocks(It &, It const, uint32_t &, size_t &, std::false_type) throw() {}
+
+    template<
+        typename It>
+    static void scan_blocks(It & it, It const eit, uint32_t & bits, size_t & size, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        if (static_cast<size_t>(eit - it) < simd::block_size)
+            return;
+        auto ors = _mm_setzero_si128();
+        auto surrogates = _mm_setzero_si128();
+        auto sums = _mm_setzero_si128();
+        do
+        {
+            auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it    ));
+            auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it + 8));
+            ors = _mm_or_si128(ors, _mm_or_si128(v0, v1));
+            surrogates = _mm_or_si128(surrogates, _mm_or_si128(
+                _mm_cmpeq_epi16(_mm_and_si128(v0, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800))),
+                _mm_cmpeq_epi16(_mm_and_si128(v1, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800)))));
+            auto const trails = _mm_packs_epi16(
+                _mm_cmpeq_epi16(_mm_and_si128(v0, _mm_set1_epi16(static_cast<short>(0xFC00))), _mm_set1_epi16(static_cast<short>(0xDC00))),
+                _mm_cmpeq_epi16(_mm_and_si128(v1, _mm_set1_epi16(static_cast<short>(0xFC00))), _mm_set1_epi16(static_cast<short>(0xDC00))));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_andnot_si128(trails, _mm_set1_epi8(1)), _mm_setzero_si128()));
+            it += simd::block_size;
+        }
+        while (static_cast<size_t>(eit - it) >= simd::block_size);
+        auto const pairs = simd::reduce_or(ors);
+        bits = (pairs | pairs >> 16) & 0xFFFF;
+        if (_mm_movemask_epi8(surrogates) != 0)
+            bits |= 0x10000;
+        size = simd::reduce_sum_epi64(sums);
+#endif
+    }
+};
+
+template<>
+struct compact_scanner<utf32> final
+{
+    template<
+        typename It>
+    static compact_scan scan(It it, It const eit)
+    {
+        uint32_t bits = 0;
+        size_t size = 0;
+        scan_blocks(it, eit, bits, size, is_unit_pointer<utf32, It>());
+        for (; it != eit; ++it, ++size)
+            bits |= static_cast<uint32_t>(*it);
+        return compact_scan{compact_bound(bits), size};
+    }
+
+private:
+    template<
+        typename It>
+    static void scan_blocks(It &, It const, uint32_t &, size_t &, std::false_type) throw() {}
+
+    template<
+        typename It>
+    static void scan_blocks(It & it, It const eit, uint32_t & bits, size_t & size, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        auto const bit = it;
+        auto ors = _mm_setzero_si128();
+        while (static_cast<size_t>(eit - it) >= simd::block_size)
+        {
+            auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it     ));
+            auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it +  4));
+            auto const v2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it +  8));
+            auto const v3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it + 12));
+            ors = _mm_or_si128(ors, _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3)));
+            it += simd::block_size;
+        }
+        bits = simd::reduce_or(ors);
+        size = static_cast<size_t>(it - bit);
+#endif
+    }
+};
+
+}
+
+// Note: Keeps the code points in 1, 2 or 4 bytes each depending on the largest of them like PEP 393 does, so the random
+//       access stays O(1) while the mostly ASCII text takes the quarter of std::u32string. The storage is picked by one
+//       pass over the code units, then the text is converted into it by conv(). The surrogate code points and the
+//       code points above max_unicode_code_point are rejected by every storage.
+class compact_string final
+{
+public:
+    compact_string() throw()
+        : size_(0)
+        , unit_size_(1)
+        , ascii_(true)
+    {
+        units_.latin1 = nullptr;
+    }
+
+    template<
+        typename Ch>
+    explicit compact_string(std::basic_string<Ch> const & str)
+        : compact_string()
+    {
+        assign<utf_selector_t<Ch>>(str.data(), str.data() + str.size());
+    }
+
+    compact_string(compact_string const & other)
+        : compact_string()
+    {
+        compact_string res;
+        res.allocate(other.unit_size_, other.ascii_, other.size_);
+        if (other.size_ != 0)
+            std::memcpy(res.units_.latin1, other.units_.latin1, other.size_ * other.unit_size_);
+        swap(res);
+    }
+
+    compact_string(compact_string && other) throw()
+        : compact_string()
+    {
+        swap(other);
+    }
+
+    ~compact_string()
+    {
+        release();
+    }
+
+    compact_string & operator=(compact_string other) throw()
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(compact_string & other) throw()
+    {
+        std::swap(units_, other.units_);
+        std::swap(size_, other.size_);
+        std::swap(unit_size_, other.unit_size_);
+        std::swap(ascii_, other.ascii_);
+    }
+
+    // Note: The text is validated by the conversion and the storage, the string is left unchanged on the error.
+    template<
+        typename Utf,
+        typename It>
+    void assign(It const it, It const eit)
+    {
+        auto const scan = detail::compact_scanner<Utf>::scan(it, eit);
+        compact_string res;
+        if (scan.bound == 0x7F)
+        {
+            res.allocate(1, true, scan.size);
+            utf::conv<Utf, utf8>(it, eit, res.units_.latin1);
+        }
+        else if (scan.bound == 0xFF)
+        {
+            res.allocate(1, false, scan.size);
+            auto const verify_fn = [&eit] (It & it)
+                {
+                    if (it == eit)
+                        throw std::runtime_error("Not enough input");
+                };
+            auto oit = res.units_.latin1;
+            for (auto rit = it; rit != eit;)
+                *oit++ = static_cast<uint8_t>(Utf::read(rit, verify_fn));
+        }
+        else if (scan.bound == 0xFFFF)
+        {
+            res.allocate(2, false, scan.size);
+            utf::conv<Utf, utf16>(it, eit, res.units_.ucs2);
+        }
+        else
+        {
+            res.allocate(4, false, scan.size);
+            utf::conv<Utf, utf32>(it, eit, res.units_.ucs4);
+            // Note: The UTF32 output takes any code point, so it is checked like the UCS2 storage checks it.
+            for (size_t n = 0; n < scan.size; ++n)
+            {
+                uint32_t const cp = res.units_.ucs4[n];
+                if (cp > max_unicode_code_point)
+                    throw std::runtime_error("Unsupported code point");
+                if (is_surrogate(cp))
+                    throw std::runtime_error("Surrogate code point detected");
+            }
+        }
+        swap(res);
+    }
+
+    size_t size() const throw()
+    {
+        return size_;
+    }
+
+    bool empty() const throw()
+    {
+        return size_ == 0;
+    }
+
+    // Note: Gives the bytes per code point: 1, 2 or 4.
+    size_t unit_size() const throw()
+    {
+        return unit_size_;
+    }
+
+    uint32_t operator[](size_t const n) const throw()
+    {
+        switch (unit_size_)
+        {
+        case 1: return units_.latin1[n];
+        case 2: return units_.ucs2[n];
+        default: return units_.ucs4[n];
+        }
+    }
+
+    // Note: The storage is picked by the largest code point, so the equal texts have the same storage.
+    bool operator==(compact_string const & other) const throw()
+    {
+        return
+            size_ == other.size_ &&
+            unit_size_ == other.unit_size_ &&
+            (size_ == 0 || std::memcmp(units_.latin1, other.units_.latin1, size_ * unit_size_) == 0);
+    }
+
+    bool operator!=(compact_string const & other) const throw()
+    {
+        return !(*this == other);
+    }
+
+    template<
+        typename Outf,
+        typename Oit>
+    Oit conv(Oit oit) const
+    {
+        switch (unit_size_)
+        {
+        case 1:
+            if (ascii_)
+                return utf::conv<utf8, Outf>(units_.latin1, units_.latin1 + size_, oit);
+            for (auto it = units_.latin1, eit = units_.latin1 + size_; it != eit; ++it)
+                Outf::write(*it, oit);
+            return oit;
+        case 2:
+            return utf::conv<utf16, Outf>(units_.ucs2, units_.ucs2 + size_, oit);
+        default:
+            return utf::conv<utf32, Outf>(units_.ucs4, units_.ucs4 + size_, oit);
+        }
+    }
+
+    template<
+        typename Och>
+    std::basic_string<Och> str() const
+    {
+        std::basic_string<Och> res;
+        conv<utf_selector_t<Och>>(std::back_inserter(res));
+        return res;
+    }
+
+private:
+    void allocate(size_t const unit_size, bool const ascii, size_t const size)
+    {
+        switch (unit_size)
+        {
+        case 1: units_.latin1 = new uint8_t[size]; break;
+        case 2: units_.ucs2 = new char16_t[size]; break;
+        default: units_.ucs4 = new char32_t[size]; break;
+        }
+        size_ = size;
+        unit_size_ = static_cast<uint8_t>(unit_size);
+        ascii_ = ascii;
+    }
+
+    void release() throw()
+    {
+        switch (unit_size_)
+        {
+        case 1: delete[] units_.latin1; break;
+        case 2: delete[] units_.ucs2; break;
+        default: delete[] units_.ucs4; break;
+        }
+    }
+
+    union units
+    {
+        uint8_t * latin1;
+        char16_t * ucs2;
+        char32_t * ucs4;
+    };
+
+    units units_;
+    size_t size_;
+    uint8_t unit_size_;
+    bool ascii_;
+};
+
+inline void swap(compact_string & a, compact_string & b) throw()
+{
+    a.swap(b);
+}
+
+}}
@@ -40,15 +40,44 @@
 #endif
 #endif
 
+#if !defined(WW898_UTF_SSE2) && !defined(WW898_UTF_DISABLE_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WW898_UTF_SSE2
+#endif
+#endif
+
+// Note: The debug builds verify the input of conv_unchecked.
+#if !defined(WW898_UTF_VERIFY_UNCHECKED) && !defined(WW898_UTF_DISABLE_VERIFY_UNCHECKED) && !defined(NDEBUG)
+#define WW898_UTF_VERIFY_UNCHECKED
+#endif
+
+#if !defined(WW898_UTF_LITTLE_ENDIAN)
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define WW898_UTF_LITTLE_ENDIAN
+#endif
+#endif
+
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <iterator>
+#include <type_traits>
 #include <string>
+#include <vector>
 
 #if __cpp_lib_string_view >= 201606
 #include <string_view>
 #endif
 
+#if defined(WW898_UTF_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(WW898_UTF_COUNTERS)
+#include <atomic>
+#endif
+
 namespace ww898 {
 namespace utf {
 
@@ -81,6 +110,155 @@ inline bool is_surrogate(uint32_t const cp) throw()
     return min_surrogate <= cp && cp <= max_surrogate;
 }
 
+namespace detail {
+
+template<
+    typename = void>
+struct utf8_dfa_table final
+{
+    static size_t const class_count = 8;
+    static uint8_t const accept = 0;
+    static uint8_t const reject = class_count;
+    static uint8_t const classes[256];
+    static uint8_t const masks[class_count];
+    static uint8_t const transitions[7 * class_count];
+};
+
+// Note: Classes: 0 - [0x00‥0x7F], 1 - [0x80‥0xBF], 2 - [0xC0‥0xDF], 3 - [0xE0‥0xEF], 4 - [0xF0‥0xF7], 5 - [0xF8‥0xFB],
+//       6 - [0xFC‥0xFD], 7 - [0xFE‥0xFF].
+template<
+    typename T>
+uint8_t const utf8_dfa_table<T>::classes[256] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 7, 7
+};
+
+template<
+    typename T>
+uint8_t const utf8_dfa_table<T>::masks[class_count] = { 0x7F, 0x00, 0x1F, 0x0F, 0x07, 0x03, 0x01, 0x00 };
+
+// Note: States: accept, reject and 1‥5 expected slave symbols.
+template<
+    typename T>
+uint8_t const utf8_dfa_table<T>::transitions[7 * class_count] =
+{
+     0,  8, 16, 24, 32, 40, 48,  8,
+     8,  8,  8,  8,  8,  8,  8,  8,
+     8,  0,  8,  8,  8,  8,  8,  8,
+     8, 16,  8,  8,  8,  8,  8,  8,
+     8, 24,  8,  8,  8,  8,  8,  8,
+     8, 32,  8,  8,  8,  8,  8,  8,
+     8, 40,  8,  8,  8,  8,  8,  8
+};
+
+template<
+    typename = void>
+struct utf8_strict_dfa_table final
+{
+    static size_t const class_count = 13;
+    static uint8_t const accept = 0;
+    static uint8_t const reject = class_count;
+    static uint8_t const classes[256];
+    static uint8_t const masks[class_count];
+    static uint8_t const transitions[9 * class_count];
+};
+
+// Note: Classes: 0 - [0x00‥0x7F], 1 - [0x80‥0x8F], 2 - [0x90‥0x9F], 3 - [0xA0‥0xBF], 4 - [0xC0‥0xC1], 5 - [0xC2‥0xDF],
+//       6 - 0xE0, 7 - [0xE1‥0xEC] or [0xEE‥0xEF], 8 - 0xED, 9 - 0xF0, 10 - [0xF1‥0xF3], 11 - 0xF4, 12 - [0xF5‥0xFF].
+template<
+    typename T>
+uint8_t const utf8_strict_dfa_table<T>::classes[256] =
+{
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+     4,  4,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,
+     6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  7,  9, 10, 10, 10, 11, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+};
+
+template<
+    typename T>
+uint8_t const utf8_strict_dfa_table<T>::masks[class_count] = { 0x7F, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x0F, 0x0F, 0x0F, 0x07, 0x07, 0x07, 0x00 };
+
+// Note: States: accept, reject, 1 and 2 expected slave symbols, 0xE0 and 0xED second symbols, 3 expected slave symbols,
+//       0xF0 and 0xF4 second symbols. The overlong forms, the surrogates and the code points above 0x10FFFF are rejected.
+template<
+    typename T>
+uint8_t const utf8_strict_dfa_table<T>::transitions[9 * class_count] =
+{
+      0,  13,  13,  13,  13,  26,  52,  39,  65,  91,  78, 104,  13,
+     13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,   0,   0,   0,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  26,  26,  26,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  13,  13,  26,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  26,  26,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  39,  39,  39,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  13,  39,  39,  13,  13,  13,  13,  13,  13,  13,  13,  13,
+     13,  39,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13
+};
+
+template<
+    typename Ch>
+void store_le32(Ch * const ptr, uint32_t const v) throw()
+{
+    static_assert(sizeof(Ch) == 1, "Byte output is expected");
+#if defined(WW898_UTF_LITTLE_ENDIAN)
+    memcpy(ptr, &v, sizeof(v));
+#else
+    ptr[0] = static_cast<Ch>(v      );
+    ptr[1] = static_cast<Ch>(v >>  8);
+    ptr[2] = static_cast<Ch>(v >> 16);
+    ptr[3] = static_cast<Ch>(v >> 24);
+#endif
+}
+
+// Note: Table driven decoder in the style of Bjoern Hoehrmann's DFA. The states are premultiplied by the class count,
+//       so every slave symbol costs two table lookups and no comparisons except the loop exit.
+template<
+    typename Table>
+struct utf8_dfa final
+{
+    template<
+        typename It,
+        typename VerifyFn>
+    static uint32_t read(It & it, VerifyFn && verify_fn)
+    {
+        uint8_t const chf = *it++;
+        if (chf < 0x80)
+            return chf;
+        auto const type = Table::classes[chf];
+        uint32_t cp = chf & Table::masks[type];
+        auto state = Table::transitions[type];
+        if (state == Table::reject)
+            throw std::runtime_error((chf & 0xC0) == 0x80
+                ? "Unexpected UTF8 slave symbol at master position"
+                : "Invalid UTF8 master symbol");
+        do
+        {
+            verify_fn(it);
+            uint8_t const chn = *it++;
+            cp = (cp << 6) | (chn & 0x3F);
+            state = Table::transitions[state + Table::classes[chn]];
+        }
+        while (state > Table::reject);
+        if (state == Table::reject)
+            throw std::runtime_error("Invalid UTF8 slave symbol");
+        return cp;
+    }
+};
+
+}
+
 struct utf8 final
 {
     static size_t const max_unicode_symbol_size = 4;
@@ -118,6 +296,9 @@ struct utf8 final
         typename VerifyFn>
     static uint32_t read(It & it, VerifyFn && verify_fn)
     {
+#if defined(WW898_UTF8_DFA)
+        return read_dfa(it, std::forward<VerifyFn>(verify_fn));
+#else
         uint8_t const chf = *it++;
         if (chf < 0x80)      // 0xxx_xxxx
             return chf;
@@ -161,6 +342,41 @@ struct utf8 final
             cp = (cp << 6) | (chn & 0x3F);
         }
         return cp;
+#endif
+    }
+
+    // Note: Decodes the same symbols as read() by the table driven DFA with no comparison chain for the master symbol,
+    //       the WW898_UTF8_DFA macro makes read() use it.
+    template<
+        typename It,
+        typename VerifyFn>
+    static uint32_t read_dfa(It & it, VerifyFn && verify_fn)
+    {
+        return detail::utf8_dfa<detail::utf8_dfa_table<>>::read(it, std::forward<VerifyFn>(verify_fn));
+    }
+
+    // Note: Trusts the input, the master symbol only selects the symbol size and the slave symbols are not verified.
+    template<
+        typename It>
+    static uint32_t read_unchecked(It & it) throw()
+    {
+        uint32_t const chf = static_cast<uint8_t>(*it++);
+        if (chf < 0x80)
+            return chf;
+        if (chf < 0xE0)
+            return (chf & 0x1F) << 6 | slave_unchecked(it);
+        auto const ch1 = slave_unchecked(it);
+        auto const ch2 = slave_unchecked(it);
+        if (chf < 0xF0)
+            return (chf & 0x0F) << 12 | ch1 << 6 | ch2;
+        auto const ch3 = slave_unchecked(it);
+        if (chf < 0xF8)
+            return (chf & 0x07) << 18 | ch1 << 12 | ch2 << 6 | ch3;
+        auto const ch4 = slave_unchecked(it);
+        if (chf < 0xFC)
+            return (chf & 0x03) << 24 | ch1 << 18 | ch2 << 12 | ch3 << 6 | ch4;
+        auto const ch5 = slave_unchecked(it);
+        return (chf & 0x01) << 30 | ch1 << 24 | ch2 << 18 | ch3 << 12 | ch4 << 6 | ch5;
     }
 
     template<
@@ -207,6 +423,124 @@ struct utf8 final
         else
             throw std::runtime_error("Unsupported UTF8 code point");
     }
+
+    template<
+        typename It>
+    static uint32_t slave_unchecked(It & it) throw()
+    {
+        return static_cast<uint8_t>(*it++) & 0x3F;
+    }
+
+    // Note: The range check of write() is reached only by the code points which don't fit 5 bytes.
+    template<
+        typename Oit>
+    static void write_unchecked(uint32_t const cp, Oit & oit)
+    {
+        write(cp, oit);
+    }
+
+    // Note: Builds the symbol in registers and stores 4 bytes at once, the output should have 3 bytes of slack after the
+    //       symbol. The 5 and 6 byte symbols are stored by two 4 byte stores.
+    template<
+        typename Ch>
+    static void write_wide(uint32_t const cp, Ch * & optr)
+    {
+        if (cp < 0x80)
+            *optr++ = static_cast<Ch>(cp);
+        else if (cp < 0x800)
+        {
+            detail::store_le32(optr, 0x80C0 | cp >> 6 | (cp & 0x3F) << 8);
+            optr += 2;
+        }
+        else if (cp < 0x10000)
+        {
+            detail::store_le32(optr, 0x8080E0 | cp >> 12 | (cp >> 6 & 0x3F) << 8 | (cp & 0x3F) << 16);
+            optr += 3;
+        }
+        else if (cp < 0x200000)
+        {
+            detail::store_le32(optr, 0x808080F0 | cp >> 18 | (cp >> 12 & 0x3F) << 8 | (cp >> 6 & 0x3F) << 16 | (cp & 0x3F) << 24);
+            optr += 4;
+        }
+        else if (cp < 0x4000000)
+        {
+            detail::store_le32(optr, 0x808080F8 | cp >> 24 | (cp >> 18 & 0x3F) << 8 | (cp >> 12 & 0x3F) << 16 | (cp >> 6 & 0x3F) << 24);
+            detail::store_le32(optr + 4, 0x80 | (cp & 0x3F));
+            optr += 5;
+        }
+        else if (cp < 0x80000000)
+        {
+            detail::store_le32(optr, 0x808080FC | cp >> 30 | (cp >> 24 & 0x3F) << 8 | (cp >> 18 & 0x3F) << 16 | (cp >> 12 & 0x3F) << 24);
+            detail::store_le32(optr + 4, 0x8080 | (cp >> 6 & 0x3F) | (cp & 0x3F) << 8);
+            optr += 6;
+        }
+        else
+            throw std::runtime_error("Unsupported UTF8 code point");
+    }
+};
+
+// Note: Strict UTF8 supports only unicode code points [0‥0x10FFFF] in the shortest form, the surrogates are prohibited.
+struct utf8_strict final
+{
+    static size_t const max_unicode_symbol_size = 4;
+    static size_t const max_supported_symbol_size = 4;
+
+    static uint32_t const max_code_point = max_unicode_code_point;
+
+    template<
+        typename It,
+        typename NextFn>
+    static size_t sizech(It & it, NextFn && next_fn)
+    {
+        uint8_t const chf = *it++;
+        if (chf < 0x80)
+            return 1;
+        else if (chf < 0xC0)
+            throw std::runtime_error("Unexpected UTF8 slave symbol at master position");
+        else if (chf < 0xC2)
+            throw std::runtime_error("Invalid UTF8 master symbol");
+        else if (next_fn(it), chf < 0xE0)
+            return 2;
+        else if (next_fn(it), chf < 0xF0)
+            return 3;
+        else if (next_fn(it), chf < 0xF5)
+            return 4;
+        else
+            throw std::runtime_error("Invalid UTF8 master symbol");
+    }
+
+    template<
+        typename It,
+        typename VerifyFn>
+    static uint32_t read(It & it, VerifyFn && verify_fn)
+    {
+        return detail::utf8_dfa<detail::utf8_strict_dfa_table<>>::read(it, std::forward<VerifyFn>(verify_fn));
+    }
+
+    template<
+        typename It>
+    static uint32_t read_unchecked(It & it) throw()
+    {
+        return utf8::read_unchecked(it);
+    }
+
+    template<
+        typename Oit>
+    static void write(uint32_t const cp, Oit & oit)
+    {
+        if (is_surrogate(cp))
+            throw std::runtime_error("Surrogate code point detected");
+        if (cp > max_code_point)
+            throw std::runtime_error("Unsupported UTF8 code point");
+        utf8::write(cp, oit);
+    }
+
+    template<
+        typename Oit>
+    static void write_unchecked(uint32_t const cp, Oit & oit)
+    {
+        utf8::write_unchecked(cp, oit);
+    }
 };
 
 struct utf16 final
@@ -253,6 +587,19 @@ struct utf16 final
             throw std::runtime_error("Unexpected UTF16 slave symbol at master position");
     }
 
+    template<
+        typename It>
+    static uint32_t read_unchecked(It & it) throw()
+    {
+        uint16_t const chf = *it++;
+        if (chf < 0xD800 || 0xE000 <= chf)
+            return chf;
+        uint16_t const chn = *it++;
+        return (
+            static_cast<uint32_t>(chf - 0xD800) << 10 |
+            static_cast<uint32_t>(chn - 0xDC00)       ) + 0x10000;
+    }
+
     template<
         typename Oit>
     static void write(uint32_t const cp, Oit & oit)
@@ -270,6 +617,20 @@ struct utf16 final
         else
             throw std::runtime_error("Unsupported UTF16 code point");
     }
+
+    template<
+        typename Oit>
+    static void write_unchecked(uint32_t const cp, Oit & oit)
+    {
+        if (cp < 0x10000)
+            *oit++ = static_cast<uint16_t>(cp);
+        else
+        {
+            uint32_t const vl = cp - 0x10000;
+            *oit++ = static_cast<uint16_t>(0xD800 + (vl >> 10        ));
+            *oit++ = static_cast<uint16_t>(0xDC00 + (vl       & 0x3FF));
+        }
+    }
 };
 
 struct utf32 final
@@ -297,6 +658,13 @@ struct utf32 final
         return *it++;
     }
 
+    template<
+        typename It>
+    static uint32_t read_unchecked(It & it) throw()
+    {
+        return *it++;
+    }
+
     template<
         typename Oit>
     static void write(uint32_t const cp, Oit & oit)
@@ -306,90 +674,960 @@ struct utf32 final
         else
             throw std::runtime_error("Unsupported UTF32 code point");
     }
+
+    template<
+        typename Oit>
+    static void write_unchecked(uint32_t const cp, Oit & oit)
+    {
+        *oit++ = cp;
+    }
 };
 
 namespace detail {
 
+// Note: The codec of conv_unchecked, it trusts the input: the symbols are not verified and the end of the input is not
+//       checked inside the symbols. It takes the same blocks and stores as the codec it wraps.
 template<
-    size_t wchar_size>
-struct wchar_selector {};
-
-template<> struct wchar_selector<2> { typedef utf16 type; };
-template<> struct wchar_selector<4> { typedef utf32 type; };
-
-}
+    typename Utf>
+struct unchecked final
+{
+    static size_t const max_unicode_symbol_size = Utf::max_unicode_symbol_size;
+    static size_t const max_supported_symbol_size = Utf::max_supported_symbol_size;
 
-typedef detail::wchar_selector<sizeof(wchar_t)>::type utfw;
+    static uint32_t const max_code_point = Utf::max_code_point;
 
-namespace detail {
+    template<
+        typename It,
+        typename VerifyFn>
+    static uint32_t read(It & it, VerifyFn &&) throw()
+    {
+        return Utf::read_unchecked(it);
+    }
 
-template<
-    typename Ch>
-struct utf_selector {};
+    template<
+        typename Oit>
+    static void write(uint32_t const cp, Oit & oit)
+    {
+        Utf::write_unchecked(cp, oit);
+    }
 
-template<> struct utf_selector<         char> { typedef utf8  type; };
-template<> struct utf_selector<unsigned char> { typedef utf8  type; };
-template<> struct utf_selector<signed   char> { typedef utf8  type; };
-template<> struct utf_selector<char16_t     > { typedef utf16 type; };
-template<> struct utf_selector<char32_t     > { typedef utf32 type; };
-template<> struct utf_selector<wchar_t      > { typedef utfw  type; };
+    template<
+        typename Ch>
+    static void write_wide(uint32_t const cp, Ch * & optr)
+    {
+        utf8::write_wide(cp, optr);
+    }
+};
 
 }
 
-template<
-    typename Ch>
-using utf_selector = detail::utf_selector<typename std::decay<Ch>::type>;
-
-template<
-    typename Ch>
-using utf_selector_t = typename utf_selector<Ch>::type;
+namespace detail {
 
 template<
-    typename Ch1,
-    typename Ch2>
-using is_utf_same = std::is_same<utf_selector_t<Ch1>, utf_selector_t<Ch2>>;
+    typename Oit>
+void write_json_unit(uint32_t const cu, Oit & oit)
+{
+    static char const digits[] = "0123456789abcdef";
+    *oit++ = static_cast<uint8_t>('\\');
+    *oit++ = static_cast<uint8_t>('u');
+    *oit++ = static_cast<uint8_t>(digits[cu >> 12 & 0xF]);
+    *oit++ = static_cast<uint8_t>(digits[cu >>  8 & 0xF]);
+    *oit++ = static_cast<uint8_t>(digits[cu >>  4 & 0xF]);
+    *oit++ = static_cast<uint8_t>(digits[cu       & 0xF]);
+}
 
-#if __cpp_constexpr >= 201603
+// Note: The quotation mark, the reverse solidus and the control characters are escaped, the short escapes are used
+//       when JSON has them.
 template<
-    typename Ch1,
-    typename Ch2>
-inline constexpr bool is_utf_same_v = is_utf_same<Ch1, Ch2>::value;
-#endif
+    typename Oit>
+void write_json_ascii(uint32_t const cp, Oit & oit)
+{
+    if (cp >= 0x20 && cp != '"' && cp != '\\')
+    {
+        *oit++ = static_cast<uint8_t>(cp);
+        return;
+    }
+    char ch;
+    switch (cp)
+    {
+    case '"' : ch = '"' ; break;
+    case '\\': ch = '\\'; break;
+    case '\b': ch = 'b' ; break;
+    case '\f': ch = 'f' ; break;
+    case '\n': ch = 'n' ; break;
+    case '\r': ch = 'r' ; break;
+    case '\t': ch = 't' ; break;
+    default:
+        write_json_unit(cp, oit);
+        return;
+    }
+    *oit++ = static_cast<uint8_t>('\\');
+    *oit++ = static_cast<uint8_t>(ch);
+}
 
+}
 
-template<
-    typename Utf,
-    typename It>
-size_t sizech(It it)
+// Note: Output only codec which writes the content of a JSON string literal in UTF8. Only the code points which JSON
+//       requires to escape are escaped, the rest is written like utf8 does.
+struct utf8_json final
 {
-    return Utf::sizech(it, [] (It &) {});
-}
+    static size_t const max_unicode_symbol_size = 6;
+    static size_t const max_supported_symbol_size = 6;
+
+    static uint32_t const max_code_point = max_supported_code_point;
+
+    template<
+        typename Oit>
+    static void write(uint32_t const cp, Oit & oit)
+    {
+        if (cp < 0x80)
+            detail::write_json_ascii(cp, oit);
+        else
+            utf8::write(cp, oit);
+    }
+};
+
+// Note: Output only codec which writes the content of a JSON string literal in ASCII. The non ASCII code points are
+//       escaped as \uXXXX, the supplementary ones as the UTF16 surrogate pairs.
+struct utf8_json_ascii final
+{
+    static size_t const max_unicode_symbol_size = 12;
+    static size_t const max_supported_symbol_size = 12;
+
+    static uint32_t const max_code_point = max_unicode_code_point;
+
+    template<
+        typename Oit>
+    static void write(uint32_t const cp, Oit & oit)
+    {
+        if (cp < 0x80)
+            detail::write_json_ascii(cp, oit);
+        else if (cp < 0x10000)
+            detail::write_json_unit(cp, oit);
+        else if (cp <= max_code_point)
+        {
+            auto const vcp = cp - 0x10000;
+            detail::write_json_unit(min_surrogate_high | vcp >> 10, oit);
+            detail::write_json_unit(min_surrogate_low | (vcp & 0x3FF), oit);
+        }
+        else
+            throw std::runtime_error("Unsupported JSON code point");
+    }
+};
+
+namespace detail {
+
+template<
+    size_t wchar_size>
+struct wchar_selector {};
+
+template<> struct wchar_selector<2> { typedef utf16 type; };
+template<> struct wchar_selector<4> { typedef utf32 type; };
+
+}
+
+typedef detail::wchar_selector<sizeof(wchar_t)>::type utfw;
+
+namespace detail {
+
+template<
+    typename Ch>
+struct utf_selector {};
+
+template<> struct utf_selector<         char> { typedef utf8  type; };
+template<> struct utf_selector<unsigned char> { typedef utf8  type; };
+template<> struct utf_selector<signed   char> { typedef utf8  type; };
+template<> struct utf_selector<char16_t     > { typedef utf16 type; };
+template<> struct utf_selector<char32_t     > { typedef utf32 type; };
+template<> struct utf_selector<wchar_t      > { typedef utfw  type; };
+
+}
+
+template<
+    typename Ch>
+using utf_selector = detail::utf_selector<typename std::decay<Ch>::type>;
+
+template<
+    typename Ch>
+using utf_selector_t = typename utf_selector<Ch>::type;
+
+template<
+    typename Ch1,
+    typename Ch2>
+using is_utf_same = std::is_same<utf_selector_t<Ch1>, utf_selector_t<Ch2>>;
+
+#if __cpp_constexpr >= 201603
+template<
+    typename Ch1,
+    typename Ch2>
+inline constexpr bool is_utf_same_v = is_utf_same<Ch1, Ch2>::value;
+#endif
+
+namespace detail {
+
+template<
+    typename Utf>
+struct unit_size {};
+
+template<> struct unit_size<utf8 > : std::integral_constant<size_t, 1> {};
+template<> struct unit_size<utf8_strict> : unit_size<utf8> {};
+template<> struct unit_size<utf16> : std::integral_constant<size_t, 2> {};
+template<> struct unit_size<utf32> : std::integral_constant<size_t, 4> {};
+
+template<
+    typename Utf>
+struct unit_size<unchecked<Utf>> : unit_size<Utf> {};
+
+// Note: Only raw pointers to the code units of the matching width can be processed by blocks.
+template<
+    typename Utf,
+    typename It>
+struct is_unit_pointer : std::integral_constant<bool,
+    std::is_pointer<It>::value &&
+    sizeof(typename std::iterator_traits<It>::value_type) == unit_size<Utf>::value> {};
+
+template<
+    typename Ch>
+struct is_char : std::integral_constant<bool,
+    std::is_same<Ch, char>::value ||
+    std::is_same<Ch, wchar_t>::value ||
+    std::is_same<Ch, char16_t>::value ||
+    std::is_same<Ch, char32_t>::value> {};
+
+template<
+    typename It,
+    typename Ch,
+    bool = is_char<Ch>::value>
+struct is_string_iterator : std::false_type {};
+
+template<
+    typename It,
+    typename Ch>
+struct is_string_iterator<It, Ch, true> : std::integral_constant<bool,
+    std::is_same<It, typename std::basic_string<Ch>::iterator>::value ||
+    std::is_same<It, typename std::basic_string<Ch>::const_iterator>::value> {};
+
+// Note: C++11 has no contiguous iterator category, so only the iterators of std::vector and std::basic_string with the
+//       default allocators are recognized. They are unwrapped to the raw pointers for the block kernels.
+template<
+    typename It,
+    typename T = typename std::remove_cv<typename std::iterator_traits<It>::value_type>::type,
+    bool = std::is_void<T>::value || std::is_same<T, bool>::value>
+struct is_contiguous_iterator : std::integral_constant<bool,
+    std::is_same<It, typename std::vector<T>::iterator>::value ||
+    std::is_same<It, typename std::vector<T>::const_iterator>::value ||
+    is_string_iterator<It, T>::value> {};
+
+template<
+    typename It,
+    typename T>
+struct is_contiguous_iterator<It, T, true> : std::false_type {};
+
+template<
+    typename C>
+struct is_contiguous_container : std::false_type {};
+
+template<
+    typename T,
+    typename A>
+struct is_contiguous_container<std::vector<T, A>> : std::integral_constant<bool, !std::is_same<T, bool>::value> {};
+
+template<
+    typename Ch,
+    typename Tr,
+    typename A>
+struct is_contiguous_container<std::basic_string<Ch, Tr, A>> : std::true_type {};
+
+template<
+    typename Oit>
+struct is_contiguous_back_inserter : std::false_type {};
+
+template<
+    typename C>
+struct is_contiguous_back_inserter<std::back_insert_iterator<C>> : is_contiguous_container<C> {};
+
+// Note: The container of std::back_insert_iterator is a protected member, it is reachable only from a derived class.
+template<
+    typename C>
+struct back_insert_access final : std::back_insert_iterator<C>
+{
+    static C & get(std::back_insert_iterator<C> const & oit)
+    {
+        return *(oit.*&back_insert_access::container);
+    }
+};
+
+#if defined(WW898_UTF_SSE2)
+namespace simd {
+
+static size_t const block_size = 16;
+
+// Note: Loads 16 code units narrowed to bytes, fails if any of them is not ASCII.
+template<
+    size_t unit_size>
+struct ascii_block {};
+
+template<>
+struct ascii_block<1> final
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, __m128i & v) throw()
+    {
+        v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr));
+        return _mm_movemask_epi8(v) == 0;
+    }
+};
+
+template<>
+struct ascii_block<2> final
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, __m128i & v) throw()
+    {
+        auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr    ));
+        auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 8));
+        auto const hi = _mm_and_si128(_mm_or_si128(v0, v1), _mm_set1_epi16(static_cast<short>(0xFF80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) != 0xFFFF)
+            return false;
+        v = _mm_packus_epi16(v0, v1);
+        return true;
+    }
+};
+
+template<>
+struct ascii_block<4> final
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, __m128i & v) throw()
+    {
+        auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr     ));
+        auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr +  4));
+        auto const v2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr +  8));
+        auto const v3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 12));
+        auto const hi = _mm_and_si128(
+            _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3)),
+            _mm_set1_epi32(static_cast<int>(0xFFFFFF80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(hi, _mm_setzero_si128())) != 0xFFFF)
+            return false;
+        v = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+        return true;
+    }
+};
+
+template<
+    typename Ch>
+bool load_ascii(Ch const * const ptr, __m128i & v) throw()
+{
+    return ascii_block<sizeof(Ch)>::load(ptr, v);
+}
+
+// Note: Loads 16 ASCII code units when none of them needs the JSON escaping.
+template<
+    typename Ch>
+bool load_json_plain(Ch const * const ptr, __m128i & v) throw()
+{
+    if (!load_ascii(ptr, v))
+        return false;
+    auto const escaped = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_cmplt_epi8(v, _mm_set1_epi8(0x20)));
+    return _mm_movemask_epi8(escaped) == 0;
+}
+
+// Note: Loads 16 code points when all code units of the block are complete symbols.
+template<
+    typename Utf>
+struct code_point_block {};
+
+template<>
+struct code_point_block<utf8>
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, uint32_t (& cps)[block_size]) throw()
+    {
+        __m128i v;
+        if (!load_ascii(ptr, v))
+            return false;
+        auto const zero = _mm_setzero_si128();
+        auto const lo = _mm_unpacklo_epi8(v, zero);
+        auto const hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps     ), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps +  4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps +  8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps + 12), _mm_unpackhi_epi16(hi, zero));
+        return true;
+    }
+};
+
+template<>
+struct code_point_block<utf8_strict> : code_point_block<utf8> {};
+
+template<>
+struct code_point_block<utf16> final
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, uint32_t (& cps)[block_size]) throw()
+    {
+        auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr    ));
+        auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 8));
+        auto const mask = _mm_set1_epi16(static_cast<short>(0xF800));
+        auto const surrogate = _mm_set1_epi16(static_cast<short>(min_surrogate));
+        if (_mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi16(_mm_and_si128(v0, mask), surrogate),
+                _mm_cmpeq_epi16(_mm_and_si128(v1, mask), surrogate))) != 0)
+            return false;
+        auto const zero = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps     ), _mm_unpacklo_epi16(v0, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps +  4), _mm_unpackhi_epi16(v0, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps +  8), _mm_unpacklo_epi16(v1, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cps + 12), _mm_unpackhi_epi16(v1, zero));
+        return true;
+    }
+};
+
+template<>
+struct code_point_block<utf32> final
+{
+    template<
+        typename Ch>
+    static bool load(Ch const * const ptr, uint32_t (& cps)[block_size]) throw()
+    {
+        for (size_t n = 0; n < block_size; n += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(cps + n), _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + n)));
+        return true;
+    }
+};
+
+// Note: Stores 16 ASCII code units packed to bytes as the code units of the given width.
+template<
+    size_t unit_size>
+struct ascii_store {};
+
+template<>
+struct ascii_store<1> final
+{
+    template<
+        typename Och>
+    static void store(__m128i const v, Och * const optr) throw()
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr), v);
+    }
+};
+
+template<>
+struct ascii_store<2> final
+{
+    template<
+        typename Och>
+    static void store(__m128i const v, Och * const optr) throw()
+    {
+        auto const zero = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr    ), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr + 8), _mm_unpackhi_epi8(v, zero));
+    }
+};
+
+template<>
+struct ascii_store<4> final
+{
+    template<
+        typename Och>
+    static void store(__m128i const v, Och * const optr) throw()
+    {
+        auto const zero = _mm_setzero_si128();
+        auto const lo = _mm_unpacklo_epi8(v, zero);
+        auto const hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr     ), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr +  4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr +  8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+};
+
+// Note: Converts 16 code units at once when every code unit is a symbol which maps to one output code unit. Any pair
+//       does it for ASCII, the pairs of UTF16 and UTF32 do it for the whole BMP except the surrogates.
+template<
+    typename Utf,
+    typename Outf>
+struct unit_block final
+{
+    template<
+        typename Ch,
+        typename Och>
+    static bool conv(Ch const * const ptr, Och * const optr) throw()
+    {
+        __m128i v;
+        if (!load_ascii(ptr, v))
+            return false;
+        ascii_store<sizeof(Och)>::store(v, optr);
+        return true;
+    }
+};
+
+template<
+    typename Utf,
+    typename Outf>
+struct unit_block<unchecked<Utf>, unchecked<Outf>> final
+{
+    template<
+        typename Ch,
+        typename Och>
+    static bool conv(Ch const * const ptr, Och * const optr) throw()
+    {
+        return unit_block<Utf, Outf>::conv(ptr, optr);
+    }
+};
+
+template<>
+struct unit_block<utf16, utf32> final
+{
+    template<
+        typename Ch,
+        typename Och>
+    static bool conv(Ch const * const ptr, Och * const optr) throw()
+    {
+        return code_point_block<utf16>::load(ptr, reinterpret_cast<uint32_t (&)[block_size]>(*optr));
+    }
+};
+
+template<>
+struct unit_block<utf32, utf16> final
+{
+    template<
+        typename Ch,
+        typename Och>
+    static bool conv(Ch const * const ptr, Och * const optr) throw()
+    {
+        __m128i vs[4];
+        auto bad = _mm_setzero_si128();
+        auto const hi_mask = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+        auto const mask = _mm_set1_epi32(0xF800);
+        auto const surrogate = _mm_set1_epi32(min_surrogate);
+        for (size_t n = 0; n < 4; ++n)
+        {
+            vs[n] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 4 * n));
+            bad = _mm_or_si128(bad, _mm_or_si128(
+                _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(vs[n], hi_mask), _mm_setzero_si128()), _mm_set1_epi32(-1)),
+                _mm_cmpeq_epi32(_mm_and_si128(vs[n], mask), surrogate)));
+        }
+        if (_mm_movemask_epi8(bad) != 0)
+            return false;
+        // Note: SSE2 has only the signed saturation for 32 bit lanes, so the values are biased to the signed range.
+        auto const bias32 = _mm_set1_epi32(0x8000);
+        auto const bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr    ), _mm_add_epi16(bias16,
+            _mm_packs_epi32(_mm_sub_epi32(vs[0], bias32), _mm_sub_epi32(vs[1], bias32))));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(optr + 8), _mm_add_epi16(bias16,
+            _mm_packs_epi32(_mm_sub_epi32(vs[2], bias32), _mm_sub_epi32(vs[3], bias32))));
+        return true;
+    }
+};
+
+}
+#endif
+
+}
+
+
+template<
+    typename Utf,
+    typename It>
+size_t sizech(It it)
+{
+    return Utf::sizech(it, [] (It &) {});
+}
+
+template<
+    typename Utf,
+    typename It>
+size_t sizez(It it)
+{
+    size_t size = 0;
+    while (*it)
+        size += Utf::sizech(it, [] (It & it) { ++it; });
+    return size;
+}
+
+namespace detail {
+
+template<
+    typename Utf,
+    typename It>
+size_t size(It it, It const eit, std::false_type)
+{
+    auto const next_fn = [&eit] (It & it)
+        {
+            if (it++ == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    size_t size = 0;
+    while (it != eit)
+        size += Utf::sizech(it, next_fn);
+    return size;
+}
+
+template<
+    typename Utf,
+    typename It>
+size_t size(It const it, It const eit, std::true_type)
+{
+    if (it == eit)
+        return 0;
+    auto const ptr = &*it;
+    return size<Utf>(ptr, ptr + (eit - it), std::false_type());
+}
+
+}
+
+template<
+    typename Utf,
+    typename It>
+size_t size(It it, It const eit)
+{
+    return detail::size<Utf>(it, eit, detail::is_contiguous_iterator<It>());
+}
+
+namespace detail {
+
+template<
+    typename Utf>
+struct boundary {};
+
+template<>
+struct boundary<utf8>
+{
+    template<
+        typename It>
+    static It complete_end(It const it, It const eit)
+    {
+        auto cit = eit;
+        for (size_t n = 0; n < utf8::max_supported_symbol_size && cit != it; ++n)
+        {
+            uint8_t const ch = *--cit;
+            if (ch < 0x80)
+                return eit;
+            else if (0xC0 <= ch)
+            {
+                size_t const size =
+                    ch < 0xE0 ? 2 :
+                    ch < 0xF0 ? 3 :
+                    ch < 0xF8 ? 4 :
+                    ch < 0xFC ? 5 : 6;
+                return static_cast<size_t>(std::distance(cit, eit)) < size ? cit : eit;
+            }
+        }
+        return eit;
+    }
+};
+
+template<>
+struct boundary<utf8_strict> : boundary<utf8> {};
+
+template<>
+struct boundary<utf16> final
+{
+    template<
+        typename It>
+    static It complete_end(It const it, It const eit)
+    {
+        if (it == eit)
+            return eit;
+        auto cit = eit;
+        uint16_t const ch = *--cit;
+        return is_surrogate_high(ch) ? cit : eit;
+    }
+};
+
+template<>
+struct boundary<utf32> final
+{
+    template<
+        typename It>
+    static It complete_end(It, It const eit)
+    {
+        return eit;
+    }
+};
+
+template<
+    typename Utf>
+struct boundary<unchecked<Utf>> final
+{
+    template<
+        typename It>
+    static It complete_end(It const it, It const eit)
+    {
+        return boundary<Utf>::complete_end(it, eit);
+    }
+};
+
+}
+
+// Note: Returns the end of the longest prefix without a truncated symbol at the end, the input should be split there
+//       when it is converted by chunks. Invalid input is not detected here and is left to the conversion.
+template<
+    typename Utf,
+    typename It>
+It complete_end(It const it, It const eit)
+{
+    return detail::boundary<Utf>::complete_end(it, eit);
+}
+
+// Note: The counters are collected only with the WW898_UTF_COUNTERS macro defined, otherwise they stay zero. The
+//       decoded symbols are counted by their UTF8 size of 1, 2, 3 and 4 or more bytes, so the UTF16 surrogate pairs
+//       are the 4 byte symbols. The same encoding is copied without decoding and counted in bytes only.
+struct conv_counters final
+{
+    static size_t const size_classes = 4;
+
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+    uint64_t simd_code_points;
+    uint64_t scalar_code_points;
+    uint64_t symbols[size_classes];
+    uint64_t errors;
+};
+
+namespace detail {
+
+#if defined(WW898_UTF_COUNTERS)
+struct atomic_counters final
+{
+    std::atomic<uint64_t> input_bytes;
+    std::atomic<uint64_t> output_bytes;
+    std::atomic<uint64_t> simd_code_points;
+    std::atomic<uint64_t> scalar_code_points;
+    std::atomic<uint64_t> symbols[conv_counters::size_classes];
+    std::atomic<uint64_t> errors;
+};
+
+template<
+    typename Utf,
+    typename Outf>
+struct pair_counters final
+{
+    static atomic_counters values;
+};
+
+template<
+    typename Utf,
+    typename Outf>
+atomic_counters pair_counters<Utf, Outf>::values;
+
+template<
+    typename Utf>
+struct counted_codec { typedef Utf type; };
+
+template<
+    typename Utf>
+struct counted_codec<unchecked<Utf>> { typedef Utf type; };
+
+// Note: The size class is the UTF8 size of the symbol minus one, the 5 and 6 byte UTF8 symbols are taken as 4 bytes.
+//       The codecs without the units per class, like the JSON ones which escape the symbols, are not counted.
+template<
+    typename Utf>
+struct class_units
+{
+    static bool const counted = false;
+};
+
+template<>
+struct class_units<utf8>
+{
+    static bool const counted = true;
+
+    static size_t get(size_t const sc) throw()
+    {
+        return sc + 1;
+    }
+};
+
+template<>
+struct class_units<utf8_strict> : class_units<utf8> {};
+
+template<>
+struct class_units<utf16> final
+{
+    static bool const counted = true;
+
+    static size_t get(size_t const sc) throw()
+    {
+        return sc < 3 ? 1 : 2;
+    }
+};
+
+template<>
+struct class_units<utf32> final
+{
+    static bool const counted = true;
+
+    static size_t get(size_t) throw()
+    {
+        return 1;
+    }
+};
+
+inline void add_counter(std::atomic<uint64_t> & counter, uint64_t const value) throw()
+{
+    if (value)
+        counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline uint64_t load_counter(std::atomic<uint64_t> & counter, bool const reset) throw()
+{
+    return reset
+        ? counter.exchange(0, std::memory_order_relaxed)
+        : counter.load(std::memory_order_relaxed);
+}
+
+template<
+    typename Utf,
+    typename Outf>
+conv_counters load_counters(bool const reset) throw()
+{
+    auto & values = pair_counters<Utf, Outf>::values;
+    conv_counters res;
+    res.input_bytes = load_counter(values.input_bytes, reset);
+    res.output_bytes = load_counter(values.output_bytes, reset);
+    res.simd_code_points = load_counter(values.simd_code_points, reset);
+    res.scalar_code_points = load_counter(values.scalar_code_points, reset);
+    for (size_t sc = 0; sc < conv_counters::size_classes; ++sc)
+        res.symbols[sc] = load_counter(values.symbols[sc], reset);
+    res.errors = load_counter(values.errors, reset);
+    return res;
+}
+#endif
+
+// Note: Every symbol is counted against the bounds of the UTF8 sizes without branches and indexing, so the hot loops
+//       keep the counts in the registers.
+struct symbol_counts
+{
+#if defined(WW898_UTF_COUNTERS)
+    uint64_t simd_size = 0;
+    uint64_t copied = 0;
+    uint64_t scalar = 0;
+    uint64_t above_80 = 0;
+    uint64_t above_800 = 0;
+    uint64_t above_10000 = 0;
+
+    void symbol(uint32_t const cp) throw()
+    {
+        ++scalar;
+        above_80 += cp >= 0x80;
+        above_800 += cp >= 0x800;
+        above_10000 += cp >= 0x10000;
+    }
+
+    void simd(size_t const size) throw()
+    {
+        simd_size += size;
+    }
+
+    void copy() throw()
+    {
+        ++copied;
+    }
+#else
+    void symbol(uint32_t) const throw() {}
+    void simd(size_t) const throw() {}
+    void copy() const throw() {}
+#endif
+};
+
+// Note: The counts are added to the shared counters once per conversion, the conversion which throws leaves without
+//       done() and is counted as the error.
+template<
+    typename Utf,
+    typename Outf>
+struct conv_counter final : symbol_counts
+{
+#if defined(WW898_UTF_COUNTERS)
+    conv_counter() throw()
+        : done_(false)
+    {
+    }
+
+    conv_counter(conv_counter const &) = delete;
+    conv_counter & operator=(conv_counter const &) = delete;
+
+    ~conv_counter()
+    {
+        add(std::integral_constant<bool, class_units<utf>::counted && class_units<outf>::counted>());
+    }
+
+    void done() throw()
+    {
+        done_ = true;
+    }
+
+private:
+    typedef typename counted_codec<Utf>::type utf;
+    typedef typename counted_codec<Outf>::type outf;
+
+    void add(std::false_type) const throw() {}
+
+    // Note: The SSE2 blocks take only the ASCII symbols, so they are the 1 byte symbols.
+    void add(std::true_type) const throw()
+    {
+        auto & values = pair_counters<utf, outf>::values;
+        uint64_t const symbols[conv_counters::size_classes] =
+        {
+            simd_size + scalar - above_80,
+            above_80 - above_800,
+            above_800 - above_10000,
+            above_10000
+        };
+        uint64_t input_units = copied;
+        uint64_t output_units = copied;
+        for (size_t sc = 0; sc < conv_counters::size_classes; ++sc)
+        {
+            input_units += symbols[sc] * class_units<utf>::get(sc);
+            output_units += symbols[sc] * class_units<outf>::get(sc);
+            add_counter(values.symbols[sc], symbols[sc]);
+        }
+        add_counter(values.input_bytes, input_units * unit_size<utf>::value);
+        add_counter(values.output_bytes, output_units * unit_size<outf>::value);
+        add_counter(values.simd_code_points, simd_size);
+        add_counter(values.scalar_code_points, scalar);
+        add_counter(values.errors, done_ ? 0 : 1);
+    }
+
+    bool done_;
+#else
+    void done() const throw() {}
+#endif
+};
+
+}
 
 template<
     typename Utf,
-    typename It>
-size_t sizez(It it)
+    typename Outf>
+conv_counters counters() throw()
 {
-    size_t size = 0;
-    while (*it)
-        size += Utf::sizech(it, [] (It & it) { ++it; });
-    return size;
+#if defined(WW898_UTF_COUNTERS)
+    return detail::load_counters<Utf, Outf>(false);
+#else
+    return conv_counters();
+#endif
 }
 
+// Note: Returns the counters before the reset, so the periodic export gets the deltas.
 template<
     typename Utf,
-    typename It>
-size_t size(It it, It const eit)
+    typename Outf>
+conv_counters reset_counters() throw()
 {
-    auto const next_fn = [&eit] (It & it)
-        {
-            if (it++ == eit)
-                throw std::runtime_error("Not enough input");
-        };
-    size_t size = 0;
-    while (it != eit)
-        size += Utf::sizech(it, next_fn);
-    return size;
+#if defined(WW898_UTF_COUNTERS)
+    return detail::load_counters<Utf, Outf>(true);
+#else
+    return conv_counters();
+#endif
 }
 
 namespace detail {
@@ -406,11 +1644,16 @@ struct convz_strategy
 {
     Oit operator()(It it, Oit oit) const
     {
+        conv_counter<Utf, Outf> counter;
         while (true)
         {
             auto const cp = Utf::read(it, [] (It &) {});
             if (!cp)
+            {
+                counter.done();
                 return oit;
+            }
+            counter.symbol(cp);
             Outf::write(cp, oit);
         }
     }
@@ -425,16 +1668,408 @@ struct convz_strategy<Utf, Outf, It, Oit, convz_impl::binary_copy>
 {
     Oit operator()(It it, Oit oit) const
     {
+        conv_counter<Utf, Outf> counter;
         while (true)
         {
             auto const ch = *it++;
             if (!ch)
+            {
+                counter.done();
                 return oit;
+            }
             *oit++ = ch;
+            counter.copy();
+        }
+    }
+};
+
+}
+
+namespace detail {
+
+template<
+    typename It>
+It unwrap_iterator(It const it, std::false_type)
+{
+    return it;
+}
+
+// Note: The zero terminated input has at least one code unit, so the iterator can be dereferenced.
+template<
+    typename It>
+typename std::iterator_traits<It>::pointer unwrap_iterator(It const it, std::true_type)
+{
+    return &*it;
+}
+
+}
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+typename std::decay<Oit>::type convz(It && it, Oit && oit)
+{
+    typedef typename std::decay<It>::type it_type;
+    auto uit = detail::unwrap_iterator<it_type>(std::forward<It>(it), detail::is_contiguous_iterator<it_type>());
+    return detail::convz_strategy<Utf, Outf,
+            decltype(uit),
+            typename std::decay<Oit>::type,
+            std::is_same<Utf, Outf>::value
+                ? detail::convz_impl::binary_copy
+                : detail::convz_impl::normal>()(
+        uit,
+        std::forward<Oit>(oit));
+}
+
+namespace detail {
+
+enum struct conv_impl { normal, random_interator, binary_copy };
+
+template<
+    typename Oit>
+struct is_byte_pointer : std::integral_constant<bool,
+    std::is_pointer<Oit>::value &&
+    sizeof(typename std::remove_pointer<Oit>::type) == 1> {};
+
+template<
+    typename Outf,
+    typename Oit>
+struct is_unit_output : std::integral_constant<bool,
+    std::is_pointer<Oit>::value &&
+    sizeof(typename std::remove_pointer<Oit>::type) == unit_size<Outf>::value> {};
+
+template<
+    typename Outf>
+struct unit_type {};
+
+template<> struct unit_type<utf8 > { typedef uint8_t  type; };
+template<> struct unit_type<utf8_strict> : unit_type<utf8> {};
+template<> struct unit_type<utf16> { typedef uint16_t type; };
+template<> struct unit_type<utf32> { typedef uint32_t type; };
+
+template<
+    typename Utf>
+struct unit_type<unchecked<Utf>> : unit_type<Utf> {};
+
+// Note: The strict UTF8 output verifies the code points, so only the unchecked one shares the wide stores of UTF8.
+template<
+    typename Outf>
+struct has_wide_store : std::is_same<Outf, utf8> {};
+
+template<>
+struct has_wide_store<unchecked<utf8>> : std::true_type {};
+
+template<>
+struct has_wide_store<unchecked<utf8_strict>> : std::true_type {};
+
+template<
+    typename Outf,
+    typename Oit>
+struct is_wide_store : std::integral_constant<bool,
+    has_wide_store<Outf>::value &&
+    is_byte_pointer<Oit>::value> {};
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit,
+    conv_impl>
+struct conv_strategy final
+{
+    Oit operator()(It it, It const eit, Oit oit) const
+    {
+        conv_counter<Utf, Outf> counter;
+        auto const verify_fn = [&eit] (It & it)
+            {
+                if (it == eit)
+                    throw std::runtime_error("Not enough input");
+            };
+        while (it != eit)
+        {
+            auto const cp = Utf::read(it, verify_fn);
+            counter.symbol(cp);
+            Outf::write(cp, oit);
+        }
+        counter.done();
+        return oit;
+    }
+};
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+struct conv_strategy<Utf, Outf, It, Oit, conv_impl::random_interator> final
+{
+    Oit operator()(It it, It const eit, Oit oit) const
+    {
+        // Note: Every input code unit produces at least one output code unit, so the bytes stored after the symbol by
+        //       the wide stores are overwritten by the following symbols while 3 input code units are left.
+        static size_t const fast_size = Utf::max_supported_symbol_size + (is_wide_store<Outf, Oit>::value ? 3 : 0);
+        conv_counter<Utf, Outf> counter;
+        if (static_cast<size_t>(eit - it) >= fast_size)
+            it = conv_fast(it, eit - fast_size, eit, oit, counter);
+        auto const verify_fn = [&eit] (It & it)
+            {
+                if (it == eit)
+                    throw std::runtime_error("Not enough input");
+            };
+        while (it != eit)
+        {
+            auto const cp = Utf::read(it, verify_fn);
+            counter.symbol(cp);
+            Outf::write(cp, oit);
+        }
+        counter.done();
+        return oit;
+    }
+
+private:
+    // Note: The iterator is taken by value, so it stays in a register while the tail loop takes its address. The output
+    //       iterator and the counts are copied for the same reason when the function is not inlined, the symbols of the
+    //       fast loop which throws are not counted.
+    static It conv_fast(It it, It const fast_eit, It const & eit, Oit & oit_out, symbol_counts & counts_out)
+    {
+        auto oit = oit_out;
+        auto counter = counts_out;
+        it = conv_blocks(it, eit, oit, counter, is_unit_pointer<Utf, It>());
+        while (it < fast_eit)
+        {
+            // Note: The blocks are tried only before two ASCII code units in a row, so the single separators in the
+            //       text without ASCII runs cost nothing. The check does not wait for the decoded symbol.
+            if (ascii_units(it, is_unit_pointer<Utf, It>()))
+            {
+                // Note: The blocks can reach the end of the input.
+                it = conv_blocks(it, eit, oit, counter, is_unit_pointer<Utf, It>());
+                if (it >= fast_eit)
+                    break;
+            }
+            auto const cp = Utf::read(it, [] (It &) {});
+            counter.symbol(cp);
+            write(cp, oit, is_wide_store<Outf, Oit>());
+        }
+        oit_out = oit;
+        counts_out = counter;
+        return it;
+    }
+
+    static bool ascii_units(It const &, std::false_type) throw()
+    {
+        return false;
+    }
+
+    // Note: At least two code units are left in the fast loop.
+    static bool ascii_units(It const & it, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        typedef typename unit_type<Utf>::type unit;
+        return (static_cast<unit>(it[0]) | static_cast<unit>(it[1])) < 0x80;
+#else
+        return false;
+#endif
+    }
+
+    static It conv_blocks(It const it, It const &, Oit &, symbol_counts &, std::false_type)
+    {
+        return it;
+    }
+
+    // Note: Every code unit of the block is the symbol.
+    static It conv_blocks(It it, It const & eit, Oit & oit, symbol_counts & counter, std::true_type)
+    {
+#if defined(WW898_UTF_SSE2)
+        auto const bit = it;
+        while (static_cast<size_t>(eit - it) >= simd::block_size && conv_block(it, oit, is_unit_output<Outf, Oit>()))
+            it += simd::block_size;
+        counter.simd(static_cast<size_t>(it - bit));
+#endif
+        return it;
+    }
+
+#if defined(WW898_UTF_SSE2)
+    static bool conv_block(It const it, Oit & oit, std::true_type) throw()
+    {
+        if (!simd::unit_block<Utf, Outf>::conv(it, oit))
+            return false;
+        oit += simd::block_size;
+        return true;
+    }
+
+    static bool conv_block(It const it, Oit & oit, std::false_type)
+    {
+        typename unit_type<Outf>::type units[simd::block_size];
+        if (!simd::unit_block<Utf, Outf>::conv(it, units))
+            return false;
+        for (auto const unit : units)
+            *oit++ = unit;
+        return true;
+    }
+#endif
+
+    static void write(uint32_t const cp, Oit & oit, std::false_type)
+    {
+        Outf::write(cp, oit);
+    }
+
+    static void write(uint32_t const cp, Oit & oit, std::true_type)
+    {
+        Outf::write_wide(cp, oit);
+    }
+};
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+struct conv_strategy<Utf, Outf, It, Oit, conv_impl::binary_copy> final
+{
+    Oit operator()(It it, It const eit, Oit oit) const
+    {
+        conv_counter<Utf, Outf> counter;
+        while (it != eit)
+        {
+            *oit++ = *it++;
+            counter.copy();
+        }
+        counter.done();
+        return oit;
+    }
+};
+
+// Note: The plain ASCII blocks are copied as is and the rest is escaped by symbols.
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+struct json_conv_strategy
+{
+    Oit operator()(It it, It const eit, Oit oit) const
+    {
+        auto const verify_fn = [&eit] (It & it)
+            {
+                if (it == eit)
+                    throw std::runtime_error("Not enough input");
+            };
+        while (true)
+        {
+            copy_blocks(it, eit, oit, is_unit_pointer<Utf, It>());
+            for (auto n = scalar_steps; n-- > 0;)
+            {
+                if (it == eit)
+                    return oit;
+                Outf::write(Utf::read(it, verify_fn), oit);
+            }
+        }
+    }
+
+private:
+    static size_t const scalar_steps = 16;
+
+    static void copy_blocks(It &, It const &, Oit &, std::false_type) {}
+
+    static void copy_blocks(It & it, It const & eit, Oit & oit, std::true_type)
+    {
+#if defined(WW898_UTF_SSE2)
+        __m128i v;
+        while (static_cast<size_t>(eit - it) >= simd::block_size && simd::load_json_plain(it, v))
+        {
+            store(v, oit, is_byte_pointer<Oit>());
+            it += simd::block_size;
         }
+#endif
+    }
+
+#if defined(WW898_UTF_SSE2)
+    static void store(__m128i const v, Oit & oit, std::true_type) throw()
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(oit), v);
+        oit += simd::block_size;
     }
+
+    static void store(__m128i const v, Oit & oit, std::false_type)
+    {
+        uint8_t chs[simd::block_size];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(chs), v);
+        for (auto const ch : chs)
+            *oit++ = ch;
+    }
+#endif
 };
 
+template<
+    typename Utf,
+    typename It,
+    typename Oit>
+struct conv_strategy<Utf, utf8_json, It, Oit, conv_impl::random_interator> final
+    : json_conv_strategy<Utf, utf8_json, It, Oit> {};
+
+template<
+    typename Utf,
+    typename It,
+    typename Oit>
+struct conv_strategy<Utf, utf8_json_ascii, It, Oit, conv_impl::random_interator> final
+    : json_conv_strategy<Utf, utf8_json_ascii, It, Oit> {};
+
+template<
+    typename It>
+struct is_random_access : std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category> {};
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+Oit conv_range(It const it, It const eit, Oit const oit)
+{
+    return conv_strategy<Utf, Outf, It, Oit,
+            std::is_same<Utf, Outf>::value
+                ? conv_impl::binary_copy
+                : is_random_access<It>::value
+                    ? conv_impl::random_interator
+                    : conv_impl::normal>()(it, eit, oit);
+}
+
+static size_t const append_buffer_bytes = 4096;
+
+// Note: The output is converted by chunks into the buffer and appended with one insertion per chunk, so the container
+//       does not grow by the code unit. The output of the chunk which throws is not appended.
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename C>
+std::back_insert_iterator<C> conv_append(It it, It const eit, std::back_insert_iterator<C> const oit)
+{
+    typedef typename C::value_type unit;
+    static size_t const buffer_size = append_buffer_bytes / sizeof(unit);
+    static size_t const chunk_size = buffer_size / Outf::max_supported_symbol_size;
+    auto & container = back_insert_access<C>::get(oit);
+    unit units[buffer_size];
+    while (it != eit)
+    {
+        auto const cit = static_cast<size_t>(eit - it) > chunk_size
+            ? boundary<Utf>::complete_end(it, it + chunk_size)
+            : eit;
+        container.insert(container.end(), units, conv_range<Utf, Outf>(it, cit, units));
+        it = cit;
+    }
+    return oit;
+}
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+Oit conv_output(It const it, It const eit, Oit const oit, std::false_type, std::false_type)
+{
+    return conv_range<Utf, Outf>(it, eit, oit);
 }
 
 template<
@@ -442,83 +2077,48 @@ template<
     typename Outf,
     typename It,
     typename Oit>
-Oit convz(It && it, Oit && oit)
+Oit conv_output(It const it, It const eit, Oit const oit, std::true_type, std::false_type)
 {
-    return detail::convz_strategy<Utf, Outf,
-            typename std::decay<It>::type,
-            typename std::decay<Oit>::type,
-            std::is_same<Utf, Outf>::value
-                ? detail::convz_impl::binary_copy
-                : detail::convz_impl::normal>()(
-        std::forward<It>(it),
-        std::forward<Oit>(oit));
+    if (it == eit)
+        return oit;
+    auto const optr = &*oit;
+    return oit + (conv_range<Utf, Outf>(it, eit, optr) - optr);
 }
 
-namespace detail {
-
-enum struct conv_impl { normal, random_interator, binary_copy };
-
 template<
     typename Utf,
     typename Outf,
     typename It,
-    typename Oit,
-    conv_impl>
-struct conv_strategy final
+    typename Oit>
+Oit conv_output(It const it, It const eit, Oit const oit, std::false_type, std::true_type)
 {
-    Oit operator()(It it, It const eit, Oit oit) const
-    {
-        auto const verify_fn = [&eit] (It & it)
-            {
-                if (it == eit)
-                    throw std::runtime_error("Not enough input");
-            };
-        while (it != eit)
-            Outf::write(Utf::read(it, verify_fn), oit);
-        return oit;
-    }
-};
+    return conv_append<Utf, Outf>(it, eit, oit);
+}
 
 template<
     typename Utf,
     typename Outf,
     typename It,
     typename Oit>
-struct conv_strategy<Utf, Outf, It, Oit, conv_impl::random_interator> final
+Oit conv_input(It const it, It const eit, Oit const oit, std::false_type)
 {
-    Oit operator()(It it, It const eit, Oit oit) const
-    {
-        if (static_cast<size_t>(eit - it) >= Utf::max_supported_symbol_size)
-        {
-            auto const fast_eit = eit - Utf::max_supported_symbol_size;
-            while (it < fast_eit)
-                Outf::write(Utf::read(it, [] (It &) {}), oit);
-        }
-        auto const verify_fn = [&eit] (It & it)
-            {
-                if (it == eit)
-                    throw std::runtime_error("Not enough input");
-            };
-        while (it != eit)
-            Outf::write(Utf::read(it, verify_fn), oit);
-        return oit;
-    }
-};
+    return conv_output<Utf, Outf>(it, eit, oit,
+        is_contiguous_iterator<Oit>(),
+        std::integral_constant<bool, is_random_access<It>::value && is_contiguous_back_inserter<Oit>::value>());
+}
 
 template<
     typename Utf,
     typename Outf,
     typename It,
     typename Oit>
-struct conv_strategy<Utf, Outf, It, Oit, conv_impl::binary_copy> final
+Oit conv_input(It const it, It const eit, Oit const oit, std::true_type)
 {
-    Oit operator()(It it, It const eit, Oit oit) const
-    {
-        while (it != eit)
-            *oit++ = *it++;
+    if (it == eit)
         return oit;
-    }
-};
+    auto const ptr = &*it;
+    return conv_input<Utf, Outf>(ptr, ptr + (eit - it), oit, std::false_type());
+}
 
 }
 
@@ -528,26 +2128,21 @@ template<
     typename It,
     typename Eit,
     typename Oit>
-Oit conv(It && it, Eit && eit, Oit && oit)
+typename std::decay<Oit>::type conv(It && it, Eit && eit, Oit && oit)
 {
-    return detail::conv_strategy<Utf, Outf,
-            typename std::decay<It>::type,
-            typename std::decay<Oit>::type,
-            std::is_same<Utf, Outf>::value
-                ? detail::conv_impl::binary_copy
-                : std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<typename std::decay<It>::type>::iterator_category>::value
-                    ? detail::conv_impl::random_interator
-                    : detail::conv_impl::normal>()(
+    typedef typename std::decay<It>::type it_type;
+    return detail::conv_input<Utf, Outf, it_type, typename std::decay<Oit>::type>(
         std::forward<It>(it),
         std::forward<Eit>(eit),
-        std::forward<Oit>(oit));
+        std::forward<Oit>(oit),
+        detail::is_contiguous_iterator<it_type>());
 }
 
 template<
     typename Outf,
     typename Ch,
     typename Oit>
-Oit convz(Ch const * const str, Oit && oit)
+typename std::decay<Oit>::type convz(Ch const * const str, Oit && oit)
 {
     return convz<utf_selector_t<Ch>, Outf>(str, std::forward<Oit>(oit));
 }
@@ -566,9 +2161,9 @@ template<
     typename Outf,
     typename Ch,
     typename Oit>
-Oit conv(std::basic_string<Ch> const & str, Oit && oit)
+typename std::decay<Oit>::type conv(std::basic_string<Ch> const & str, Oit && oit)
 {
-    return conv<utf_selector_t<Ch>, Outf>(str.cbegin(), str.cend(), std::forward<Oit>(oit));
+    return conv<utf_selector_t<Ch>, Outf>(str.data(), str.data() + str.size(), std::forward<Oit>(oit));
 }
 
 #if __cpp_lib_string_view >= 201606
@@ -576,9 +2171,9 @@ template<
     typename Outf,
     typename Ch,
     typename Oit>
-Oit conv(std::basic_string_view<Ch> const & str, Oit && oit)
+typename std::decay<Oit>::type conv(std::basic_string_view<Ch> const & str, Oit && oit)
 {
-    return conv<utf_selector_t<Ch>, Outf>(str.cbegin(), str.cend(), std::forward<Oit>(oit));
+    return conv<utf_selector_t<Ch>, Outf>(str.data(), str.data() + str.size(), std::forward<Oit>(oit));
 }
 #endif
 
@@ -600,4 +2195,374 @@ std::basic_string<Ch> conv(std::basic_string<Ch> str) noexcept
     return str;
 }
 
+namespace detail {
+
+template<
+    typename Utf,
+    typename Outf,
+    typename It>
+bool is_convertible(It, It const, std::false_type) throw()
+{
+    return true;
+}
+
+// Note: Runs the verification of conv without the output, the single pass iterators can't be verified.
+template<
+    typename Utf,
+    typename Outf,
+    typename It>
+bool is_convertible(It it, It const eit, std::true_type) throw()
+{
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    try
+    {
+        uint32_t units[Outf::max_supported_symbol_size];
+        while (it != eit)
+        {
+            auto optr = units;
+            Outf::write(Utf::read(it, verify_fn), optr);
+        }
+        return true;
+    }
+    catch (std::runtime_error const &)
+    {
+        return false;
+    }
+}
+
+}
+
+// Note: Converts the input which is known to be valid, like the text verified when it was stored. Nothing is verified,
+//       the invalid input is undefined behaviour. The debug builds assert that the input is valid.
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Eit,
+    typename Oit>
+typename std::decay<Oit>::type conv_unchecked(It && it, Eit && eit, Oit && oit)
+{
+#if defined(WW898_UTF_VERIFY_UNCHECKED)
+    typedef typename std::decay<It>::type it_type;
+    assert((detail::is_convertible<Utf, Outf, it_type>(it, eit,
+        std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<it_type>::iterator_category>())) &&
+        "Invalid input of conv_unchecked");
+#endif
+    return conv<detail::unchecked<Utf>, detail::unchecked<Outf>>(
+        std::forward<It>(it),
+        std::forward<Eit>(eit),
+        std::forward<Oit>(oit));
+}
+
+template<
+    typename Outf,
+    typename Ch,
+    typename Oit>
+typename std::decay<Oit>::type conv_unchecked(std::basic_string<Ch> const & str, Oit && oit)
+{
+    return conv_unchecked<utf_selector_t<Ch>, Outf>(str.data(), str.data() + str.size(), std::forward<Oit>(oit));
+}
+
+template<
+    typename Och,
+    typename Ch>
+std::basic_string<Och> conv_unchecked(std::basic_string<Ch> const & str)
+{
+    std::basic_string<Och> res;
+    conv_unchecked<utf_selector_t<Och>>(str, std::back_inserter(res));
+    return res;
+}
+
+namespace detail {
+
+template<
+    typename Utf1,
+    typename Utf2,
+    typename It1,
+    typename It2>
+struct compare_strategy final
+{
+    int operator()(It1 it1, It1 const eit1, It2 it2, It2 const eit2) const
+    {
+        auto const verify_fn1 = [&eit1] (It1 & it)
+            {
+                if (it == eit1)
+                    throw std::runtime_error("Not enough input");
+            };
+        auto const verify_fn2 = [&eit2] (It2 & it)
+            {
+                if (it == eit2)
+                    throw std::runtime_error("Not enough input");
+            };
+        while (true)
+        {
+            skip_ascii(it1, eit1, it2, eit2, std::integral_constant<bool,
+                is_unit_pointer<Utf1, It1>::value &&
+                is_unit_pointer<Utf2, It2>::value>());
+            for (auto n = scalar_steps; n-- > 0;)
+            {
+                if (it1 == eit1)
+                    return it2 == eit2 ? 0 : -1;
+                if (it2 == eit2)
+                    return 1;
+                // Note: Code point order is used, so UTF16 surrogate pairs are always greater than [0xE000‥0xFFFF].
+                auto const cp1 = Utf1::read(it1, verify_fn1);
+                auto const cp2 = Utf2::read(it2, verify_fn2);
+                if (cp1 != cp2)
+                    return cp1 < cp2 ? -1 : 1;
+            }
+        }
+    }
+
+private:
+    static size_t const scalar_steps = 16;
+
+    static void skip_ascii(It1 &, It1 const &, It2 &, It2 const &, std::false_type) throw() {}
+
+    static void skip_ascii(It1 & it1, It1 const & eit1, It2 & it2, It2 const & eit2, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        while (
+            static_cast<size_t>(eit1 - it1) >= simd::block_size &&
+            static_cast<size_t>(eit2 - it2) >= simd::block_size)
+        {
+            __m128i v1, v2;
+            if (!simd::load_ascii(it1, v1) ||
+                !simd::load_ascii(it2, v2) ||
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) != 0xFFFF)
+                return;
+            it1 += simd::block_size;
+            it2 += simd::block_size;
+        }
+#endif
+    }
+};
+
+}
+
+template<
+    typename Utf1,
+    typename Utf2,
+    typename It1,
+    typename It2>
+int compare(It1 it1, It1 const eit1, It2 it2, It2 const eit2)
+{
+    return detail::compare_strategy<Utf1, Utf2, It1, It2>()(it1, eit1, it2, eit2);
+}
+
+template<
+    typename Utf1,
+    typename Utf2,
+    typename It1,
+    typename It2>
+bool equal(It1 it1, It1 const eit1, It2 it2, It2 const eit2)
+{
+    return compare<Utf1, Utf2>(it1, eit1, it2, eit2) == 0;
+}
+
+template<
+    typename Ch1,
+    typename Ch2>
+int compare(std::basic_string<Ch1> const & str1, std::basic_string<Ch2> const & str2)
+{
+    return compare<utf_selector_t<Ch1>, utf_selector_t<Ch2>>(
+        str1.data(), str1.data() + str1.size(),
+        str2.data(), str2.data() + str2.size());
+}
+
+template<
+    typename Ch1,
+    typename Ch2>
+bool equal(std::basic_string<Ch1> const & str1, std::basic_string<Ch2> const & str2)
+{
+    return compare(str1, str2) == 0;
+}
+
+#if __cpp_lib_string_view >= 201606
+template<
+    typename Ch1,
+    typename Ch2>
+int compare(std::basic_string_view<Ch1> const & str1, std::basic_string_view<Ch2> const & str2)
+{
+    return compare<utf_selector_t<Ch1>, utf_selector_t<Ch2>>(
+        str1.data(), str1.data() + str1.size(),
+        str2.data(), str2.data() + str2.size());
+}
+
+template<
+    typename Ch1,
+    typename Ch2>
+bool equal(std::basic_string_view<Ch1> const & str1, std::basic_string_view<Ch2> const & str2)
+{
+    return compare(str1, str2) == 0;
+}
+#endif
+
+namespace detail {
+
+static uint64_t const hash_basis = 0xCBF29CE484222325ull;
+static uint64_t const hash_prime = 0x100000001B3ull;
+
+constexpr uint64_t hash_power(size_t const n)
+{
+    return n == 0 ? 1 : hash_prime * hash_power(n - 1);
+}
+
+inline size_t hash_finalize(uint64_t h) throw()
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+// Note: The polynomial hash h = h * prime + cp depends only on the code point sequence, so a block of
+//       16 code points contributes h * prime^16 + sum(cp[i] * prime^(15 - i)) with no serial dependency.
+template<
+    typename Utf,
+    typename It>
+struct hash_strategy final
+{
+    size_t operator()(It it, It const eit) const
+    {
+        auto const verify_fn = [&eit] (It & it)
+            {
+                if (it == eit)
+                    throw std::runtime_error("Not enough input");
+            };
+        auto h = hash_basis;
+        while (true)
+        {
+            hash_blocks(it, eit, h, is_unit_pointer<Utf, It>());
+            for (auto n = scalar_steps; n-- > 0;)
+            {
+                if (it == eit)
+                    return hash_finalize(h);
+                h = h * hash_prime + Utf::read(it, verify_fn);
+            }
+        }
+    }
+
+private:
+    static size_t const scalar_steps = 16;
+
+    static void hash_blocks(It &, It const &, uint64_t &, std::false_type) throw() {}
+
+    static void hash_blocks(It & it, It const & eit, uint64_t & h, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        static uint64_t const powers[simd::block_size] =
+        {
+            hash_power(15), hash_power(14), hash_power(13), hash_power(12),
+            hash_power(11), hash_power(10), hash_power( 9), hash_power( 8),
+            hash_power( 7), hash_power( 6), hash_power( 5), hash_power( 4),
+            hash_power( 3), hash_power( 2), hash_power( 1), hash_power( 0)
+        };
+        uint32_t cps[simd::block_size];
+        while (static_cast<size_t>(eit - it) >= simd::block_size && simd::code_point_block<Utf>::load(it, cps))
+        {
+            uint64_t sum = 0;
+            for (size_t n = 0; n < simd::block_size; ++n)
+                sum += cps[n] * powers[n];
+            h = h * hash_power(simd::block_size) + sum;
+            it += simd::block_size;
+        }
+#endif
+    }
+};
+
+}
+
+template<
+    typename Utf,
+    typename It>
+size_t hash(It it, It const eit)
+{
+    return detail::hash_strategy<Utf, It>()(it, eit);
+}
+
+template<
+    typename Ch>
+size_t hash(std::basic_string<Ch> const & str)
+{
+    return hash<utf_selector_t<Ch>>(str.data(), str.data() + str.size());
+}
+
+#if __cpp_lib_string_view >= 201606
+template<
+    typename Ch>
+size_t hash(std::basic_string_view<Ch> const & str)
+{
+    return hash<utf_selector_t<Ch>>(str.data(), str.data() + str.size());
+}
+#endif
+
+// Note: Transparent functors for the unordered containers keyed by strings in any encoding.
+struct code_point_hash final
+{
+    typedef void is_transparent;
+
+    template<
+        typename Str>
+    size_t operator()(Str const & str) const
+    {
+        return hash(str);
+    }
+};
+
+struct code_point_equal final
+{
+    typedef void is_transparent;
+
+    template<
+        typename Str1,
+        typename Str2>
+    bool operator()(Str1 const & str1, Str2 const & str2) const
+    {
+        return equal(str1, str2);
+    }
+};
+
 }}
+
+// Note: The conversions of the common pairs by the pointers, which take the pointers, the std::basic_string iterators
+//       and the std::back_inserter into std::basic_string, are instantiated once in the utf-cpp library. With
+//       WW898_UTF_EXTERN_TEMPLATES defined the includers only see their declarations, so they compile faster. The
+//       library should be built with the same WW898_UTF_* macros as the includers.
+#define WW898_UTF_CONV_PAIRS(X) \
+    X(utf8 , char    , utf16, char16_t) \
+    X(utf8 , char    , utf32, char32_t) \
+    X(utf8 , char    , utfw , wchar_t ) \
+    X(utf16, char16_t, utf8 , char    ) \
+    X(utf16, char16_t, utf32, char32_t) \
+    X(utf16, char16_t, utfw , wchar_t ) \
+    X(utf32, char32_t, utf8 , char    ) \
+    X(utf32, char32_t, utf16, char16_t) \
+    X(utf32, char32_t, utfw , wchar_t ) \
+    X(utfw , wchar_t , utf8 , char    ) \
+    X(utfw , wchar_t , utf16, char16_t) \
+    X(utfw , wchar_t , utf32, char32_t)
+
+#define WW898_UTF_CONV_RANGE(Prefix, Utf, Ch, Outf, Och) \
+    Prefix Och * conv_range<Utf, Outf, Ch const *, Och *>(Ch const *, Ch const *, Och *); \
+    Prefix Och * conv_range<Utf, Outf, Ch       *, Och *>(Ch       *, Ch       *, Och *);
+
+#if defined(WW898_UTF_EXTERN_TEMPLATES)
+#define WW898_UTF_EXTERN_CONV_RANGE(Utf, Ch, Outf, Och) WW898_UTF_CONV_RANGE(extern template, Utf, Ch, Outf, Och)
+
+namespace ww898 {
+namespace utf {
+namespace detail {
+
+WW898_UTF_CONV_PAIRS(WW898_UTF_EXTERN_CONV_RANGE)
+
+}}}
+
+#undef WW898_UTF_EXTERN_CONV_RANGE
+#endif
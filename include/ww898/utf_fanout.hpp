@@ -0,0 +1,228 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <tuple>
+
+namespace ww898 {
+namespace utf {
+namespace detail {
+
+static size_t const fanout_buffer_size = append_buffer_bytes / sizeof(char32_t);
+
+template<
+    typename... Outfs>
+struct fanout_writer {};
+
+template<>
+struct fanout_writer<> final
+{
+    template<
+        typename Utf,
+        typename It>
+    static void write(It, It) throw() {}
+};
+
+template<
+    typename Outf,
+    typename... Outfs>
+struct fanout_writer<Outf, Outfs...> final
+{
+    template<
+        typename Utf,
+        typename It,
+        typename Oit,
+        typename... Oits>
+    static void write(It const it, It const eit, Oit & oit, Oits &... oits)
+    {
+        oit = conv<Utf, Outf>(it, eit, oit);
+        fanout_writer<Outfs...>::template write<Utf>(it, eit, oits...);
+    }
+};
+
+template<
+    typename... Outfs>
+struct fanout_verifier {};
+
+template<>
+struct fanout_verifier<> final
+{
+    static void verify(uint32_t) throw() {}
+};
+
+template<
+    typename Outf,
+    typename... Outfs>
+struct fanout_verifier<Outf, Outfs...> final
+{
+    static void verify(uint32_t const cp)
+    {
+        uint32_t units[Outf::max_supported_symbol_size];
+        auto optr = units;
+        Outf::write(cp, optr);
+        fanout_verifier<Outfs...>::verify(cp);
+    }
+};
+
+// Note: Every encoding writes every Unicode code point, so only the chunk with the surrogates or the code points above
+//       max_unicode_code_point is written into the scratch by every encoding before it is written to any output.
+template<
+    typename... Outfs>
+void fanout_verify(char32_t const * const buf, char32_t const * const bend)
+{
+    auto it = buf;
+    uint32_t unusual = 0;
+#if defined(WW898_UTF_SSE2)
+    // Note: The decoded code points are below 0x80000000, so the signed comparison works.
+    auto vunusual = _mm_setzero_si128();
+    for (; bend - it >= 4; it += 4)
+    {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it));
+        vunusual = _mm_or_si128(vunusual, _mm_or_si128(
+            _mm_cmpgt_epi32(v, _mm_set1_epi32(static_cast<int>(max_unicode_code_point))),
+            _mm_cmpeq_epi32(_mm_srli_epi32(v, 11), _mm_set1_epi32(min_surrogate >> 11))));
+    }
+    unusual = static_cast<uint32_t>(_mm_movemask_epi8(vunusual));
+#endif
+    for (; it != bend; ++it)
+        unusual |= static_cast<uint32_t>(*it > max_unicode_code_point) | static_cast<uint32_t>(*it >> 11 == min_surrogate >> 11);
+    if (unusual != 0)
+        for (it = buf; it != bend; ++it)
+            fanout_verifier<Outfs...>::verify(*it);
+}
+
+template<
+    typename Utf,
+    typename It>
+bool is_ascii_chunk(It, It const, std::false_type) throw()
+{
+    return false;
+}
+
+// Note: The ASCII chunk is converted from the input into every output, the widening is cheaper than the decoding into
+//       the code point buffer.
+template<
+    typename Utf,
+    typename It>
+bool is_ascii_chunk(It it, It const eit, std::true_type) throw()
+{
+#if defined(WW898_UTF_SSE2)
+    __m128i v;
+    for (; static_cast<size_t>(eit - it) >= simd::block_size; it += simd::block_size)
+        if (!simd::load_ascii(it, v))
+            return false;
+#endif
+    for (; it != eit; ++it)
+        if (static_cast<uint32_t>(*it) >= 0x80)
+            return false;
+    return true;
+}
+
+// Note: Decodes the input which isn't random access by the symbols.
+template<
+    typename Utf,
+    typename It>
+char32_t * fanout_decode(It & it, It const eit, char32_t * const buf)
+{
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    auto bit = buf;
+    for (; it != eit && bit != buf + fanout_buffer_size; ++bit)
+        *bit = Utf::read(it, verify_fn);
+    return bit;
+}
+
+template<
+    typename Utf,
+    typename... Outfs,
+    typename It,
+    typename... Oits>
+It fanout_chunk(It it, It const eit, char32_t * const buf, std::false_type, Oits &... oits)
+{
+    auto const bend = fanout_decode<Utf>(it, eit, buf);
+    fanout_verify<Outfs...>(buf, bend);
+    fanout_writer<Outfs...>::template write<utf32>(static_cast<char32_t const *>(buf), static_cast<char32_t const *>(bend), oits...);
+    return it;
+}
+
+// Note: The random access input is decoded into the code point buffer by conv() with the SSE2 blocks.
+template<
+    typename Utf,
+    typename... Outfs,
+    typename It,
+    typename... Oits>
+It fanout_chunk(It const it, It const eit, char32_t * const buf, std::true_type, Oits &... oits)
+{
+    auto const cit = static_cast<size_t>(eit - it) > fanout_buffer_size
+        ? boundary<Utf>::complete_end(it, it + fanout_buffer_size)
+        : eit;
+    if (is_ascii_chunk<Utf>(it, cit, is_unit_pointer<Utf, It>()))
+        fanout_writer<Outfs...>::template write<Utf>(it, cit, oits...);
+    else
+    {
+        auto const bend = conv<Utf, utf32>(it, cit, buf);
+        fanout_verify<Outfs...>(buf, bend);
+        fanout_writer<Outfs...>::template write<utf32>(static_cast<char32_t const *>(buf), static_cast<char32_t const *>(bend), oits...);
+    }
+    return cit;
+}
+
+}
+
+// Note: Converts the text into several encodings at once: every chunk of the input is decoded once into the code point
+//       buffer and converted from it into every output, so the decoding isn't repeated per output. The outputs get
+//       every chunk after it is decoded and checked against every encoding, so the chunk which fails the decoding or
+//       the encoding isn't written to any of them. Only the exceptions of the outputs themselves, like std::bad_alloc
+//       of std::back_inserter, leave the outputs with the different parts of the chunk.
+template<
+    typename Utf,
+    typename... Outfs,
+    typename It,
+    typename... Oits>
+std::tuple<Oits...> conv_fanout(It it, It const eit, Oits... oits)
+{
+    static_assert(sizeof...(Outfs) == sizeof...(Oits), "The number of the encodings differs from the outputs");
+    char32_t buf[detail::fanout_buffer_size];
+    while (it != eit)
+        it = detail::fanout_chunk<Utf, Outfs...>(it, eit, buf, detail::is_random_access<It>(), oits...);
+    return std::tuple<Oits...>(oits...);
+}
+
+// Note: Appends the text to every output string in its encoding.
+template<
+    typename Ch,
+    typename... Ochs>
+void conv_fanout(std::basic_string<Ch> const & str, std::basic_string<Ochs> &... outs)
+{
+    conv_fanout<utf_selector_t<Ch>, utf_selector_t<Ochs>...>(
+        str.data(), str.data() + str.size(), std::back_inserter(outs)...);
+}
+
+}}
@@ -0,0 +1,149 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace ww898 {
+namespace utf {
+namespace detail {
+
+// Note: The output which would overwrite the input not read yet waits in the tail, it is copied to the storage as soon
+//       as the input frees the place for it.
+template<
+    typename Och>
+class in_place_tail final
+{
+public:
+    in_place_tail()
+        : head_(0)
+    {}
+
+    bool empty() const throw()
+    {
+        return head_ == units_.size();
+    }
+
+    void append(Och const * const it, Och const * const eit)
+    {
+        if (head_ != 0 && 2 * head_ >= units_.size())
+        {
+            units_.erase(units_.begin(), units_.begin() + head_);
+            head_ = 0;
+        }
+        units_.insert(units_.end(), it, eit);
+    }
+
+    // Note: Copies to the storage at the offset the units which fit into the free bytes, gives the new offset.
+    size_t flush(char * const base, size_t offset, size_t const limit) throw()
+    {
+        auto const count = std::min(units_.size() - head_, (limit - offset) / sizeof(Och));
+        if (count != 0)
+        {
+            std::memcpy(base + offset, units_.data() + head_, count * sizeof(Och));
+            head_ += count;
+            offset += count * sizeof(Och);
+        }
+        return offset;
+    }
+
+    size_t bytes() const throw()
+    {
+        return (units_.size() - head_) * sizeof(Och);
+    }
+
+private:
+    std::vector<Och> units_;
+    size_t head_;
+};
+
+}
+
+// Note: Converts the text in the contiguous storage, like std::basic_string or std::vector, into the Och code units in
+//       the same memory and gives their number. The output starts at the storage data and is read through
+//       reinterpret_cast<Och const *>. The chunks are converted by conv() through the small buffer and copied over the
+//       input already read. UTF32 to UTF16 or UTF8 and UTF16 to UTF8 for the ASCII and the 2 byte symbols never take
+//       more bytes than they read, otherwise the output waits in the tail until the input frees the place. The storage
+//       grows at the end only when the whole output is larger than the input, then it is resized to the least number
+//       of its units holding the output with the rest of the last unit zeroed. When the conversion throws the storage
+//       keeps its size, but its content is unspecified.
+template<
+    typename Och,
+    typename C>
+size_t conv_in_place(C & storage)
+{
+    typedef typename C::value_type unit;
+    typedef utf_selector_t<unit> Utf;
+    typedef utf_selector_t<Och> Outf;
+    static size_t const buffer_size = detail::append_buffer_bytes / sizeof(Och);
+    static size_t const chunk_size = buffer_size / Outf::max_supported_symbol_size;
+    auto const size = storage.size();
+    if (size == 0)
+        return 0;
+    auto ptr = &storage[0];
+    auto const base = reinterpret_cast<char *>(ptr);
+    Och units[buffer_size];
+    detail::in_place_tail<Och> tail;
+    size_t offset = 0;
+    for (size_t pos = 0; pos != size;)
+    {
+        auto const it = ptr + pos;
+        auto const eit = size - pos > chunk_size
+            ? detail::boundary<Utf>::complete_end(it, it + chunk_size)
+            : ptr + size;
+        auto const oeit = detail::conv_range<Utf, Outf>(static_cast<unit const *>(it), static_cast<unit const *>(eit), units);
+        pos = static_cast<size_t>(eit - ptr);
+        auto const limit = pos * sizeof(unit);
+        auto const bytes = static_cast<size_t>(oeit - units) * sizeof(Och);
+        if (tail.empty() && offset + bytes <= limit)
+        {
+            std::memcpy(base + offset, units, bytes);
+            offset += bytes;
+        }
+        else
+        {
+            tail.append(units, oeit);
+            offset = tail.flush(base, offset, limit);
+        }
+    }
+    if (!tail.empty())
+    {
+        auto const total = offset + tail.bytes();
+        if (total > size * sizeof(unit))
+            storage.resize((total + sizeof(unit) - 1) / sizeof(unit));
+        offset = tail.flush(reinterpret_cast<char *>(&storage[0]), offset, total);
+    }
+    auto const new_size = (offset + sizeof(unit) - 1) / sizeof(unit);
+    storage.resize(new_size);
+    if (new_size != 0)
+        std::memset(reinterpret_cast<char *>(&storage[0]) + offset, 0, new_size * sizeof(unit) - offset);
+    return offset / sizeof(Och);
+}
+
+}}
@@ -0,0 +1,263 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+#include <ww898/utf_nfc_tables.hpp>
+
+namespace ww898 {
+namespace utf {
+
+// Note: The result of the NFC quick check from UAX #15: the text is in NFC for yes, is not for no and needs the full
+//       normalization to tell for maybe.
+enum struct nfc_quick_check { yes, maybe, no };
+
+namespace detail {
+
+inline uint16_t nfc_properties(uint32_t const cp) throw()
+{
+    typedef nfc_tables<> tables;
+    if (cp > tables::max_code_point)
+        return 0;
+    auto const block = tables::stage1[cp >> tables::block_shift];
+    return tables::properties[tables::stage2[
+        static_cast<size_t>(block) << tables::block_shift | (cp & ((1u << tables::block_shift) - 1))]];
+}
+
+#if defined(WW898_UTF_SSE2)
+namespace simd {
+
+// Note: Gives the number of the code units at the start of 16 code units which are the complete code points below 0x300,
+//       they are the starters with NFC_Quick_Check=Yes. Zero is given when the block is not taken.
+template<
+    size_t unit_size>
+struct nfc_starter_block {};
+
+// Note: Only the ASCII and the 2 byte symbols with the master code units [0xC2‥0xCB] are taken, every slave code unit
+//       follows its master code unit. The master code unit at the end of the block is left for the next one.
+template<>
+struct nfc_starter_block<1> final
+{
+    template<
+        typename Ch>
+    static size_t check(Ch const * const ptr) throw()
+    {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr));
+        auto const slaves = _mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(0xC0))));
+        auto const masters = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(0xC1))),
+            _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(0xCC)))));
+        if ((masters << 1 & 0xFFFF) != slaves || (masters | slaves) != _mm_movemask_epi8(v))
+            return 0;
+        return (masters & 0x8000) != 0 ? block_size - 1 : block_size;
+    }
+};
+
+template<>
+struct nfc_starter_block<2> final
+{
+    template<
+        typename Ch>
+    static size_t check(Ch const * const ptr) throw()
+    {
+        auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr    ));
+        auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 8));
+        auto const hi = _mm_srli_epi16(_mm_max_epu8(v0, v1), 8);
+        return _mm_movemask_epi8(_mm_cmplt_epi16(hi, _mm_set1_epi16(3))) == 0xFFFF ? block_size : 0;
+    }
+};
+
+template<>
+struct nfc_starter_block<4> final
+{
+    template<
+        typename Ch>
+    static size_t check(Ch const * const ptr) throw()
+    {
+        auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr     ));
+        auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr +  4));
+        auto const v2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr +  8));
+        auto const v3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + 12));
+        auto const hi = _mm_srli_epi32(_mm_max_epu8(_mm_max_epu8(v0, v1), _mm_max_epu8(v2, v3)), 8);
+        return _mm_movemask_epi8(_mm_cmplt_epi32(hi, _mm_set1_epi32(3))) == 0xFFFF ? block_size : 0;
+    }
+};
+
+}
+#endif
+
+// Note: Follows the NFC quick check from UAX #15: the combining classes of the non-starters must not decrease and the
+//       worst NFC_Quick_Check of the code points is the result. The blocks of the starters below 0x300 are skipped
+//       with SSE2.
+template<
+    typename Utf,
+    typename It>
+class nfc_quick_checker final
+{
+public:
+    nfc_quick_checker() throw()
+        : last_ccc_(0)
+        , result_(nfc_quick_check::yes)
+    {}
+
+    It skip(It const it, It const eit) throw()
+    {
+        return skip_blocks(it, eit, is_unit_pointer<Utf, It>());
+    }
+
+    void check(uint32_t const cp) throw()
+    {
+        if (cp < nfc_tables<>::min_code_point)
+        {
+            last_ccc_ = 0;
+            return;
+        }
+        auto const properties = nfc_properties(cp);
+        if (properties == 0)
+        {
+            last_ccc_ = 0;
+            return;
+        }
+        uint32_t const ccc = properties & 0xFF;
+        auto const qc = ccc != 0 && last_ccc_ > ccc
+            ? nfc_quick_check::no
+            : static_cast<nfc_quick_check>(properties >> 8);
+        if (result_ < qc)
+            result_ = qc;
+        last_ccc_ = ccc;
+    }
+
+    nfc_quick_check result() const throw()
+    {
+        return result_;
+    }
+
+    static size_t const scalar_steps = 16;
+
+private:
+    It skip_blocks(It const it, It const, std::false_type) throw()
+    {
+        return it;
+    }
+
+    It skip_blocks(It it, It const eit, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        auto const bit = it;
+        while (static_cast<size_t>(eit - it) >= simd::block_size)
+        {
+            auto const size = simd::nfc_starter_block<unit_size<Utf>::value>::check(it);
+            if (size == 0)
+                break;
+            it += size;
+        }
+        if (it != bit)
+            last_ccc_ = 0;
+#endif
+        return it;
+    }
+
+    uint32_t last_ccc_;
+    nfc_quick_check result_;
+};
+
+}
+
+// Note: The no result is returned at the first code point which breaks NFC.
+template<
+    typename Utf,
+    typename It>
+nfc_quick_check is_nfc_quick(It it, It const eit)
+{
+    detail::nfc_quick_checker<Utf, It> checker;
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    while (it != eit)
+    {
+        it = checker.skip(it, eit);
+        for (auto n = checker.scalar_steps; n-- > 0 && it != eit;)
+        {
+            checker.check(Utf::read(it, verify_fn));
+            if (checker.result() == nfc_quick_check::no)
+                return nfc_quick_check::no;
+        }
+    }
+    return checker.result();
+}
+
+// Note: Converts the text like conv() and gives the NFC quick check of it as the by-product, so only the rare maybe
+//       and no texts need the full normalization. The skipped blocks of the starters are converted by conv().
+template<
+    typename Utf,
+    typename Outf,
+    typename It,
+    typename Oit>
+Oit conv_nfc_check(It it, It const eit, Oit oit, nfc_quick_check & result)
+{
+    detail::nfc_quick_checker<Utf, It> checker;
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    while (it != eit)
+    {
+        auto const bit = it;
+        it = checker.skip(it, eit);
+        if (it != bit)
+            oit = conv<Utf, Outf>(bit, it, oit);
+        for (auto n = checker.scalar_steps; n-- > 0 && it != eit;)
+        {
+            auto const cp = Utf::read(it, verify_fn);
+            checker.check(cp);
+            Outf::write(cp, oit);
+        }
+    }
+    result = checker.result();
+    return oit;
+}
+
+template<
+    typename Ch>
+nfc_quick_check is_nfc_quick(std::basic_string<Ch> const & str)
+{
+    return is_nfc_quick<utf_selector_t<Ch>>(str.data(), str.data() + str.size());
+}
+
+template<
+    typename Och,
+    typename Ch>
+std::basic_string<Och> conv_nfc_check(std::basic_string<Ch> const & str, nfc_quick_check & result)
+{
+    std::basic_string<Och> res;
+    conv_nfc_check<utf_selector_t<Ch>, utf_selector_t<Och>>(
+        str.data(), str.data() + str.size(), std::back_inserter(res), result);
+    return res;
+}
+
+}}
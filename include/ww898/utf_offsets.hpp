@@ -0,0 +1,202 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+namespace ww898 {
+namespace utf {
+
+// Note: The same position in the text as the offsets in UTF8 code units, UTF16 code units and code points.
+struct text_offset final
+{
+    size_t u8;
+    size_t u16;
+    size_t cp;
+};
+
+inline bool operator==(text_offset const & x, text_offset const & y) throw()
+{
+    return x.u8 == y.u8 && x.u16 == y.u16 && x.cp == y.cp;
+}
+
+inline bool operator!=(text_offset const & x, text_offset const & y) throw()
+{
+    return !(x == y);
+}
+
+namespace detail {
+
+// Note: The offset units are given by the codecs: utf8, utf16 and utf32 for the code points.
+template<
+    typename Unit>
+struct offset_field {};
+
+template<> struct offset_field<utf8 > { static size_t text_offset::* member() throw() { return &text_offset::u8 ; } };
+template<> struct offset_field<utf16> { static size_t text_offset::* member() throw() { return &text_offset::u16; } };
+template<> struct offset_field<utf32> { static size_t text_offset::* member() throw() { return &text_offset::cp ; } };
+
+inline size_t utf8_symbol_size(uint32_t const cp) throw()
+{
+    return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : cp < 0x200000 ? 4 : cp < 0x4000000 ? 5 : 6;
+}
+
+inline size_t utf16_symbol_size(uint32_t const cp)
+{
+    if (cp > max_unicode_code_point)
+        throw std::runtime_error("Unsupported UTF16 code point");
+    return cp < 0x10000 ? 1 : 2;
+}
+
+// Note: Walks the text forward keeping all the offsets of the current symbol boundary, so the sorted offsets are found
+//       in one pass. The offset inside a symbol is rounded down to its start, the offset past the end gives the end.
+template<
+    typename Utf,
+    typename Unit,
+    typename It>
+class offset_finder final
+{
+public:
+    offset_finder(It const it, It const eit)
+        : it_(it)
+        , eit_(eit)
+        , pos_({ 0, 0, 0 })
+    {}
+
+    text_offset const & find(size_t const offset)
+    {
+        auto const member = offset_field<Unit>::member();
+        if (offset < pos_.*member)
+            throw std::invalid_argument("Unsorted offsets");
+        auto const verify_fn = [this] (It & it)
+            {
+                if (it == eit_)
+                    throw std::runtime_error("Not enough input");
+            };
+        while (true)
+        {
+            skip_blocks(offset, is_unit_pointer<Utf, It>());
+            for (auto n = scalar_steps; n-- > 0;)
+            {
+                if (it_ == eit_)
+                    return pos_;
+                auto it = it_;
+                auto const cp = Utf::read(it, verify_fn);
+                auto next = pos_;
+                next.u8 += utf8_symbol_size(cp);
+                next.u16 += utf16_symbol_size(cp);
+                ++next.cp;
+                if (next.*member > offset)
+                    return pos_;
+                it_ = it;
+                pos_ = next;
+            }
+        }
+    }
+
+private:
+    static size_t const scalar_steps = 16;
+
+    void skip_blocks(size_t, std::false_type) throw() {}
+
+    void skip_blocks(size_t const offset, std::true_type) throw()
+    {
+#if defined(WW898_UTF_SSE2)
+        auto const member = offset_field<Unit>::member();
+        __m128i v;
+        while (
+            static_cast<size_t>(eit_ - it_) >= simd::block_size &&
+            pos_.*member + simd::block_size <= offset &&
+            simd::load_ascii(it_, v))
+        {
+            it_ += simd::block_size;
+            pos_.u8 += simd::block_size;
+            pos_.u16 += simd::block_size;
+            pos_.cp += simd::block_size;
+        }
+#endif
+    }
+
+    It it_;
+    It const eit_;
+    text_offset pos_;
+};
+
+}
+
+// Note: Finds the position of the offset given in Unit (utf8, utf16 or utf32 for the code points) in the Utf text.
+template<
+    typename Utf,
+    typename Unit,
+    typename It>
+text_offset find_offset(It const it, It const eit, size_t const offset)
+{
+    return detail::offset_finder<Utf, Unit, It>(it, eit).find(offset);
+}
+
+// Note: Converts the offset from Unit to Ounit, for example the LSP UTF16 columns to the UTF8 byte offsets.
+template<
+    typename Utf,
+    typename Unit,
+    typename Ounit,
+    typename It>
+size_t conv_offset(It const it, It const eit, size_t const offset)
+{
+    return find_offset<Utf, Unit>(it, eit, offset).*detail::offset_field<Ounit>::member();
+}
+
+// Note: Finds the positions of the sorted offsets in one pass over the text.
+template<
+    typename Utf,
+    typename Unit,
+    typename It,
+    typename OffsetIt,
+    typename Oit>
+Oit find_offsets(It const it, It const eit, OffsetIt offset_it, OffsetIt const offset_eit, Oit oit)
+{
+    detail::offset_finder<Utf, Unit, It> finder(it, eit);
+    for (; offset_it != offset_eit; ++offset_it)
+        *oit++ = finder.find(*offset_it);
+    return oit;
+}
+
+template<
+    typename Unit,
+    typename Ch>
+text_offset find_offset(std::basic_string<Ch> const & str, size_t const offset)
+{
+    return find_offset<utf_selector_t<Ch>, Unit>(str.data(), str.data() + str.size(), offset);
+}
+
+template<
+    typename Unit,
+    typename Ounit,
+    typename Ch>
+size_t conv_offset(std::basic_string<Ch> const & str, size_t const offset)
+{
+    return conv_offset<utf_selector_t<Ch>, Unit, Ounit>(str.data(), str.data() + str.size(), offset);
+}
+
+}}
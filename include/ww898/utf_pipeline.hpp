@@ -0,0 +1,256 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_streambuf.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace ww898 {
+namespace utf {
+
+namespace detail {
+
+// Note: The blocks go through the ring of slots in order: the reader fills the slot read_seq % slot count, the workers
+//       convert the slots in [convert_seq‥read_seq) in any order, the writer flushes the slot write_seq % slot count
+//       when it is converted. The reader waits for the writer when the ring is full, so the memory stays bounded.
+template<
+    typename Utf,
+    typename Outf,
+    typename Ch,
+    typename Och>
+class pipeline final
+{
+    struct slot final
+    {
+        std::vector<Ch > ibuf;
+        size_t isize;
+        std::vector<Och> obuf;
+        size_t osize;
+        bool converted;
+    };
+
+public:
+    pipeline(
+        std::basic_streambuf<Ch > & ibuf,
+        std::basic_streambuf<Och> & obuf,
+        size_t const worker_count,
+        size_t const block_size)
+        : ibuf_(ibuf)
+        , obuf_(obuf)
+        , worker_count_(worker_count)
+        , block_size_(block_size)
+        , slots_(2 * worker_count + 2)
+        , read_seq_(0)
+        , convert_seq_(0)
+        , write_seq_(0)
+        , eof_(false)
+    {
+        if (worker_count_ == 0)
+            throw std::invalid_argument("No workers");
+        if (block_size_ < Utf::max_supported_symbol_size)
+            throw std::invalid_argument("Too small block size");
+    }
+
+    pipeline(pipeline const &) = delete;
+    pipeline & operator=(pipeline const &) = delete;
+
+    void run()
+    {
+        std::vector<std::thread> threads;
+        try
+        {
+            threads.reserve(worker_count_ + 1);
+            threads.emplace_back([this] { guard([this] { read(); }); });
+            for (size_t n = 0; n < worker_count_; ++n)
+                threads.emplace_back([this] { guard([this] { convert(); }); });
+            write();
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+        for (auto & thread : threads)
+            thread.join();
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+private:
+    template<
+        typename Fn>
+    void guard(Fn && fn) throw()
+    {
+        try
+        {
+            fn();
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+    }
+
+    void fail(std::exception_ptr const & error)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+            error_ = error;
+        cv_.notify_all();
+    }
+
+    void read()
+    {
+        std::vector<Ch> pending;
+        while (true)
+        {
+            slot * s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return error_ || read_seq_ - write_seq_ < slots_.size(); });
+                if (error_)
+                    return;
+                s = &slots_[read_seq_ % slots_.size()];
+            }
+            s->ibuf.resize(block_size_);
+            s->obuf.resize(block_size_ * Outf::max_supported_symbol_size);
+            auto const beg = s->ibuf.data();
+            auto end = std::copy(pending.cbegin(), pending.cend(), beg);
+            auto cend = end;
+            while (true)
+            {
+                auto const read = ibuf_.sgetn(end, static_cast<std::streamsize>(beg + block_size_ - end));
+                end += read;
+                // Note: The rest is converted as is at the end of input to report the truncated symbol.
+                cend = read > 0 ? complete_end<Utf>(beg, end) : end;
+                if (read == 0 || cend != beg)
+                    break;
+            }
+            pending.assign(cend, end);
+            s->isize = static_cast<size_t>(cend - beg);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (beg == end)
+            {
+                eof_ = true;
+                cv_.notify_all();
+                return;
+            }
+            ++read_seq_;
+            cv_.notify_all();
+        }
+    }
+
+    void convert()
+    {
+        while (true)
+        {
+            slot * s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return error_ || convert_seq_ < read_seq_ || eof_; });
+                if (error_ || convert_seq_ == read_seq_)
+                    return;
+                s = &slots_[convert_seq_++ % slots_.size()];
+            }
+            auto const obeg = s->obuf.data();
+            s->osize = static_cast<size_t>(conv<Utf, Outf>(s->ibuf.data(), s->ibuf.data() + s->isize, obeg) - obeg);
+            std::lock_guard<std::mutex> lock(mutex_);
+            s->converted = true;
+            cv_.notify_all();
+        }
+    }
+
+    void write()
+    {
+        while (true)
+        {
+            slot * s;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                s = &slots_[write_seq_ % slots_.size()];
+                cv_.wait(lock, [this, s] { return error_ || s->converted || (eof_ && write_seq_ == read_seq_); });
+                if (error_ || !s->converted)
+                    return;
+            }
+            auto const size = static_cast<std::streamsize>(s->osize);
+            if (obuf_.sputn(s->obuf.data(), size) != size)
+                throw std::runtime_error("Failed to write output");
+            std::lock_guard<std::mutex> lock(mutex_);
+            s->converted = false;
+            ++write_seq_;
+            cv_.notify_all();
+        }
+    }
+
+    std::basic_streambuf<Ch > & ibuf_;
+    std::basic_streambuf<Och> & obuf_;
+    size_t const worker_count_;
+    size_t const block_size_;
+    std::vector<slot> slots_;
+    size_t read_seq_;
+    size_t convert_seq_;
+    size_t write_seq_;
+    bool eof_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+}
+
+static size_t const default_pipeline_block_size = 1024 * 1024;
+
+inline size_t default_pipeline_worker_count() throw()
+{
+    // Note: The reader and the writer threads mostly wait for I/O.
+    auto const count = std::thread::hardware_concurrency();
+    return count > 2 ? count - 2 : 1;
+}
+
+// Note: Converts the whole input stream buffer to the output one like the loop over conv() by blocks, but the reading,
+//       the conversion and the writing overlap: one thread reads, worker_count threads convert the blocks split at the
+//       symbol boundaries, the calling thread writes the blocks in order. The first error stops all the threads and is
+//       rethrown, the output gets a prefix of the converted blocks then.
+template<
+    typename Utf,
+    typename Outf,
+    typename Ch = typename detail::utf_char<Utf>::type,
+    typename Och = typename detail::utf_char<Outf>::type>
+void conv_pipeline(
+    std::basic_streambuf<Ch > & ibuf,
+    std::basic_streambuf<Och> & obuf,
+    size_t const worker_count = default_pipeline_worker_count(),
+    size_t const block_size = default_pipeline_block_size)
+{
+    detail::pipeline<Utf, Outf, Ch, Och>(ibuf, obuf, worker_count, block_size).run();
+}
+
+}}
@@ -0,0 +1,481 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+#include <ww898/utf_offsets.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+namespace ww898 {
+namespace utf {
+
+// Note: The size of the text or the position in it in UTF8 code units, UTF16 code units, code points and lines, the
+//       position is on the line given by the number of the line feeds before it.
+struct text_metrics final
+{
+    size_t u8;
+    size_t u16;
+    size_t cp;
+    size_t lines;
+};
+
+inline bool operator==(text_metrics const & x, text_metrics const & y) throw()
+{
+    return x.u8 == y.u8 && x.u16 == y.u16 && x.cp == y.cp && x.lines == y.lines;
+}
+
+inline bool operator!=(text_metrics const & x, text_metrics const & y) throw()
+{
+    return !(x == y);
+}
+
+namespace detail {
+
+inline void add_metrics(text_metrics & x, text_metrics const & y) throw()
+{
+    x.u8 += y.u8;
+    x.u16 += y.u16;
+    x.cp += y.cp;
+    x.lines += y.lines;
+}
+
+template<
+    typename Unit>
+struct metrics_field {};
+
+template<> struct metrics_field<utf8 > { static size_t text_metrics::* member() throw() { return &text_metrics::u8 ; } };
+template<> struct metrics_field<utf16> { static size_t text_metrics::* member() throw() { return &text_metrics::u16; } };
+template<> struct metrics_field<utf32> { static size_t text_metrics::* member() throw() { return &text_metrics::cp ; } };
+
+// Note: Counts the valid UTF8 text without the decoding: every code unit which is not a slave one starts a code point
+//       and the 4 byte symbols take two UTF16 code units.
+inline text_metrics count_metrics(char const * it, char const * const eit) throw()
+{
+    text_metrics res = { static_cast<size_t>(eit - it), 0, 0, 0 };
+    size_t slaves = 0;
+    size_t pairs = 0;
+#if defined(WW898_UTF_SSE2)
+    auto slave_sums = _mm_setzero_si128();
+    auto pair_sums = _mm_setzero_si128();
+    auto line_sums = _mm_setzero_si128();
+    for (; static_cast<size_t>(eit - it) >= simd::block_size; it += simd::block_size)
+    {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(it));
+        auto const ones = _mm_set1_epi8(1);
+        // Note: The slave code units [0x80‥0xBF] are the signed bytes below -0x40, the 4 byte masters [0xF0‥0xF7] are
+        //       the ones above -0x11.
+        auto const slave_units = _mm_cmplt_epi8(v, _mm_set1_epi8(-0x40));
+        auto const pair_units = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(-0x11)),
+            _mm_cmplt_epi8(v, _mm_setzero_si128()));
+        auto const line_units = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        slave_sums = _mm_add_epi64(slave_sums, _mm_sad_epu8(_mm_and_si128(slave_units, ones), _mm_setzero_si128()));
+        pair_sums = _mm_add_epi64(pair_sums, _mm_sad_epu8(_mm_and_si128(pair_units, ones), _mm_setzero_si128()));
+        line_sums = _mm_add_epi64(line_sums, _mm_sad_epu8(_mm_and_si128(line_units, ones), _mm_setzero_si128()));
+    }
+    uint64_t sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), slave_sums);
+    slaves = static_cast<size_t>(sums[0] + sums[1]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), pair_sums);
+    pairs = static_cast<size_t>(sums[0] + sums[1]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), line_sums);
+    res.lines = static_cast<size_t>(sums[0] + sums[1]);
+#endif
+    for (; it != eit; ++it)
+    {
+        uint8_t const ch = *it;
+        if ((ch & 0xC0) == 0x80)
+            ++slaves;
+        else if (ch >= 0xF0)
+            ++pairs;
+        else if (ch == '\n')
+            ++res.lines;
+    }
+    res.cp = res.u8 - slaves;
+    res.u16 = res.cp + pairs;
+    return res;
+}
+
+// Note: The node of the treap keeps the chunk of the text, the counts of the chunk and of the whole subtree.
+struct rope_node final
+{
+    std::string text;
+    text_metrics own;
+    text_metrics sum;
+    uint32_t priority;
+    std::unique_ptr<rope_node> left;
+    std::unique_ptr<rope_node> right;
+};
+
+}
+
+// Note: Keeps the UTF8 text in the chunks of the treap ordered by the position, every node caches the counts of its
+//       subtree, so the edits and the conversions of the positions between the UTF8, UTF16, code point and line
+//       coordinates take O(log n) time. The positions are given in the Unit (utf8, utf16 or utf32 for the code points)
+//       and are rounded down to the start of the symbol, the positions past the end give the end.
+class rope final
+{
+public:
+    static size_t const max_chunk_size = 1024;
+
+    rope() throw()
+        : seed_(0x9E3779B9u)
+    {}
+
+    template<
+        typename Ch>
+    explicit rope(std::basic_string<Ch> const & str)
+        : rope()
+    {
+        insert<utf8>(0, str);
+    }
+
+    text_metrics metrics() const throw()
+    {
+        return metrics(root_.get());
+    }
+
+    bool empty() const throw()
+    {
+        return !root_;
+    }
+
+    // Note: Gives the position in all the coordinates.
+    template<
+        typename Unit>
+    text_metrics find(size_t offset) const
+    {
+        auto const member = detail::metrics_field<Unit>::member();
+        text_metrics pos = {};
+        auto n = root_.get();
+        while (n != nullptr)
+        {
+            auto const left = metrics(n->left.get());
+            if (offset < left.*member)
+            {
+                n = n->left.get();
+                continue;
+            }
+            offset -= left.*member;
+            detail::add_metrics(pos, left);
+            if (offset < n->own.*member)
+            {
+                auto const ptr = n->text.data();
+                auto const local = find_offset<utf8, Unit>(ptr, ptr + n->text.size(), offset);
+                detail::add_metrics(pos, detail::count_metrics(ptr, ptr + local.u8));
+                return pos;
+            }
+            offset -= n->own.*member;
+            detail::add_metrics(pos, n->own);
+            n = n->right.get();
+        }
+        return pos;
+    }
+
+    // Note: Gives the position of the start of the line.
+    text_metrics find_line(size_t line) const
+    {
+        text_metrics pos = {};
+        auto n = root_.get();
+        while (line != 0 && n != nullptr)
+        {
+            auto const left = metrics(n->left.get());
+            if (line <= left.lines)
+            {
+                n = n->left.get();
+                continue;
+            }
+            line -= left.lines;
+            detail::add_metrics(pos, left);
+            if (line <= n->own.lines)
+            {
+                auto ptr = n->text.data();
+                for (; line-- != 0; ++ptr)
+                    ptr = static_cast<char const *>(std::memchr(ptr, '\n', n->text.data() + n->text.size() - ptr));
+                detail::add_metrics(pos, detail::count_metrics(n->text.data(), ptr));
+                return pos;
+            }
+            line -= n->own.lines;
+            detail::add_metrics(pos, n->own);
+            n = n->right.get();
+        }
+        return pos;
+    }
+
+    template<
+        typename Unit,
+        typename Ounit>
+    size_t conv_offset(size_t const offset) const
+    {
+        return find<Unit>(offset).*detail::metrics_field<Ounit>::member();
+    }
+
+    // Note: The text is verified and stored as UTF8, the rope is left unchanged on the invalid text.
+    template<
+        typename Unit,
+        typename Utf,
+        typename It>
+    void insert(size_t const offset, It const it, It const eit)
+    {
+        std::string text;
+        utf::conv<Utf, utf8_strict>(it, eit, std::back_inserter(text));
+        std::unique_ptr<detail::rope_node> middle;
+        for (size_t pos = 0; pos < text.size();)
+        {
+            auto const size = chunk_size(text, pos);
+            middle = merge(std::move(middle), make_node(text.substr(pos, size)));
+            pos += size;
+        }
+        auto parts = split<Unit>(std::move(root_), offset);
+        root_ = join(join(std::move(parts.first), std::move(middle)), std::move(parts.second));
+    }
+
+    template<
+        typename Unit,
+        typename Ch>
+    void insert(size_t const offset, std::basic_string<Ch> const & str)
+    {
+        insert<Unit, utf_selector_t<Ch>>(offset, str.data(), str.data() + str.size());
+    }
+
+    template<
+        typename Unit>
+    void erase(size_t const first, size_t const last)
+    {
+        if (first >= last)
+            return;
+        auto tail = split<Unit>(std::move(root_), last);
+        auto head = split<Unit>(std::move(tail.first), first);
+        root_ = join(std::move(head.first), std::move(tail.second));
+    }
+
+    template<
+        typename Outf,
+        typename Oit>
+    Oit conv(Oit oit) const
+    {
+        return conv<Outf>(root_.get(), 0, metrics().u8, oit);
+    }
+
+    template<
+        typename Och>
+    std::basic_string<Och> str() const
+    {
+        std::basic_string<Och> res;
+        conv<utf_selector_t<Och>>(std::back_inserter(res));
+        return res;
+    }
+
+    template<
+        typename Unit,
+        typename Och>
+    std::basic_string<Och> substr(size_t const first, size_t const last) const
+    {
+        std::basic_string<Och> res;
+        auto const begin = find<Unit>(first).u8;
+        auto const end = find<Unit>(last).u8;
+        if (begin < end)
+            conv<utf_selector_t<Och>>(root_.get(), begin, end, std::back_inserter(res));
+        return res;
+    }
+
+private:
+    typedef std::unique_ptr<detail::rope_node> node_ptr;
+
+    static text_metrics metrics(detail::rope_node const * const n) throw()
+    {
+        return n != nullptr ? n->sum : text_metrics{};
+    }
+
+    static void update(detail::rope_node & n) throw()
+    {
+        n.sum = metrics(n.left.get());
+        detail::add_metrics(n.sum, n.own);
+        detail::add_metrics(n.sum, metrics(n.right.get()));
+    }
+
+    static void recount(detail::rope_node & n) throw()
+    {
+        n.own = detail::count_metrics(n.text.data(), n.text.data() + n.text.size());
+    }
+
+    // Note: The chunks end at the code point boundaries.
+    static size_t chunk_size(std::string const & text, size_t const pos) throw()
+    {
+        auto size = text.size() - pos;
+        if (size > max_chunk_size)
+            size = max_chunk_size;
+        if (pos + size != text.size())
+            while ((static_cast<uint8_t>(text[pos + size]) & 0xC0) == 0x80)
+                --size;
+        return size;
+    }
+
+    node_ptr make_node(std::string text)
+    {
+        // Note: The xorshift generator gives the priorities, the same edits build the same tree.
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        node_ptr n(new detail::rope_node());
+        n->text = std::move(text);
+        n->priority = seed_;
+        recount(*n);
+        update(*n);
+        return n;
+    }
+
+    static node_ptr merge(node_ptr x, node_ptr y) throw()
+    {
+        if (!x)
+            return y;
+        if (!y)
+            return x;
+        if (x->priority > y->priority)
+        {
+            x->right = merge(std::move(x->right), std::move(y));
+            update(*x);
+            return x;
+        }
+        y->left = merge(std::move(x), std::move(y->left));
+        update(*y);
+        return y;
+    }
+
+    // Note: Splits the chunk inside at the code point boundary, the node of the right half takes the priority of the
+    //       node, so the heap order holds.
+    template<
+        typename Unit>
+    std::pair<node_ptr, node_ptr> split(node_ptr n, size_t offset)
+    {
+        if (!n)
+            return std::pair<node_ptr, node_ptr>();
+        auto const member = detail::metrics_field<Unit>::member();
+        auto const left = metrics(n->left.get());
+        if (offset > left.*member)
+        {
+            offset -= left.*member;
+            if (offset >= n->own.*member)
+            {
+                auto parts = split<Unit>(std::move(n->right), offset - n->own.*member);
+                n->right = std::move(parts.first);
+                update(*n);
+                return std::make_pair(std::move(n), std::move(parts.second));
+            }
+            auto const ptr = n->text.data();
+            auto const pos = find_offset<utf8, Unit>(ptr, ptr + n->text.size(), offset).u8;
+            if (pos != 0)
+            {
+                node_ptr r(new detail::rope_node());
+                r->text.assign(n->text, pos, std::string::npos);
+                r->priority = n->priority;
+                r->right = std::move(n->right);
+                n->text.resize(pos);
+                recount(*n);
+                recount(*r);
+                update(*n);
+                update(*r);
+                return std::make_pair(std::move(n), std::move(r));
+            }
+            offset = left.*member;
+        }
+        auto parts = split<Unit>(std::move(n->left), offset);
+        n->left = std::move(parts.second);
+        update(*n);
+        return std::make_pair(std::move(parts.first), std::move(n));
+    }
+
+    // Note: Joins the chunks at the seam when they fit into one, so the small edits don't fragment the text.
+    static node_ptr join(node_ptr x, node_ptr y)
+    {
+        if (x && y)
+        {
+            auto last = x.get();
+            while (last->right)
+                last = last->right.get();
+            auto first = y.get();
+            while (first->left)
+                first = first->left.get();
+            if (last->text.size() + first->text.size() <= max_chunk_size)
+            {
+                append_last(*x, first->text);
+                y = erase_first(std::move(y));
+            }
+        }
+        return merge(std::move(x), std::move(y));
+    }
+
+    static void append_last(detail::rope_node & n, std::string const & text)
+    {
+        if (n.right)
+            append_last(*n.right, text);
+        else
+        {
+            n.text += text;
+            recount(n);
+        }
+        update(n);
+    }
+
+    static node_ptr erase_first(node_ptr n) throw()
+    {
+        if (!n->left)
+            return std::move(n->right);
+        n->left = erase_first(std::move(n->left));
+        update(*n);
+        return n;
+    }
+
+    // Note: Converts the part [begin‥end) of the subtree given in the UTF8 code units from its start. The stored text is
+    //       valid, so it is not verified again, but the exceptions of the output like std::bad_alloc are passed on.
+    template<
+        typename Outf,
+        typename Oit>
+    static Oit conv(detail::rope_node const * const n, size_t begin, size_t end, Oit oit)
+    {
+        if (n == nullptr || begin >= end)
+            return oit;
+        auto const left = metrics(n->left.get()).u8;
+        if (begin < left)
+            oit = conv<Outf>(n->left.get(), begin, std::min(end, left), oit);
+        auto const own = n->text.size();
+        auto const own_begin = begin > left ? begin - left : 0;
+        auto const own_end = std::min(end > left ? end - left : 0, own);
+        if (own_begin < own_end)
+            oit = conv_unchecked<utf8, Outf>(n->text.data() + own_begin, n->text.data() + own_end, oit);
+        if (end > left + own)
+            oit = conv<Outf>(n->right.get(), begin > left + own ? begin - left - own : 0, end - left - own, oit);
+        return oit;
+    }
+
+    node_ptr root_;
+    uint32_t seed_;
+};
+
+}}
@@ -0,0 +1,179 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <algorithm>
+#include <streambuf>
+#include <vector>
+
+namespace ww898 {
+namespace utf {
+
+namespace detail {
+
+template<
+    typename Utf>
+struct utf_char {};
+
+template<> struct utf_char<utf8 > { typedef char     type; };
+template<> struct utf_char<utf8_strict> : utf_char<utf8> {};
+template<> struct utf_char<utf16> { typedef char16_t type; };
+template<> struct utf_char<utf32> { typedef char32_t type; };
+
+}
+
+// Note: Works like std::wbuffer_convert. The underlying stream buffer holds Utf code units, they are converted to Outf
+//       code units on reading and back to Utf on writing. Both directions work by blocks of block_size code units,
+//       symbols split between blocks are carried over to the next one.
+template<
+    typename Utf,
+    typename Outf,
+    typename Ch = typename detail::utf_char<Utf>::type,
+    typename Och = typename detail::utf_char<Outf>::type>
+class basic_transcoding_streambuf final : public std::basic_streambuf<Och>
+{
+    typedef std::basic_streambuf<Och> base_type;
+
+public:
+    typedef typename base_type::char_type char_type;
+    typedef typename base_type::traits_type traits_type;
+    typedef typename base_type::int_type int_type;
+
+    static size_t const default_block_size = 64 * 1024;
+
+    explicit basic_transcoding_streambuf(
+        std::basic_streambuf<Ch> * const buf,
+        size_t const block_size = default_block_size)
+        : buf_(buf)
+        , block_size_(block_size)
+        , ipending_(0)
+    {
+        if (block_size_ < Utf::max_supported_symbol_size || block_size_ < Outf::max_supported_symbol_size)
+            throw std::invalid_argument("Too small block size");
+    }
+
+    basic_transcoding_streambuf(basic_transcoding_streambuf const &) = delete;
+    basic_transcoding_streambuf & operator=(basic_transcoding_streambuf const &) = delete;
+
+    ~basic_transcoding_streambuf()
+    {
+        try
+        {
+            sync();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    std::basic_streambuf<Ch> * rdbuf() const throw()
+    {
+        return buf_;
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (this->gptr() < this->egptr())
+            return traits_type::to_int_type(*this->gptr());
+        if (iext_.empty())
+        {
+            iext_.resize(block_size_);
+            iint_.resize(block_size_ * Outf::max_supported_symbol_size);
+        }
+        while (true)
+        {
+            auto const beg = iext_.data();
+            auto const read = buf_->sgetn(beg + ipending_, static_cast<std::streamsize>(block_size_ - ipending_));
+            auto const end = beg + ipending_ + static_cast<size_t>(read);
+            if (beg == end)
+                return traits_type::eof();
+            // Note: The rest is converted as is at the end of input to report the truncated symbol.
+            auto const cend = read > 0 ? complete_end<Utf>(beg, end) : end;
+            auto const ibeg = iint_.data();
+            auto const iend = conv<Utf, Outf>(beg, cend, ibeg);
+            ipending_ = static_cast<size_t>(std::copy(cend, end, beg) - beg);
+            if (ibeg != iend)
+            {
+                this->setg(ibeg, ibeg, iend);
+                return traits_type::to_int_type(*ibeg);
+            }
+        }
+    }
+
+    int_type overflow(int_type const ch) override
+    {
+        if (!this->pbase())
+        {
+            oint_.resize(block_size_);
+            oext_.resize(block_size_ * Utf::max_supported_symbol_size);
+            this->setp(oint_.data(), oint_.data() + oint_.size());
+        }
+        else if (!write_complete())
+            return traits_type::eof();
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        *this->pptr() = traits_type::to_char_type(ch);
+        this->pbump(1);
+        return ch;
+    }
+
+    int sync() override
+    {
+        if (this->pbase() && !write_complete())
+            return -1;
+        return buf_->pubsync();
+    }
+
+private:
+    bool write_complete()
+    {
+        auto const beg = this->pbase();
+        auto const end = this->pptr();
+        auto const cend = complete_end<Outf>(beg, end);
+        auto const obeg = oext_.data();
+        auto const size = conv<Outf, Utf>(beg, cend, obeg) - obeg;
+        auto const rest = std::copy(cend, end, beg) - beg;
+        this->setp(beg, beg + oint_.size());
+        this->pbump(static_cast<int>(rest));
+        return buf_->sputn(obeg, size) == size;
+    }
+
+    std::basic_streambuf<Ch> * const buf_;
+    size_t const block_size_;
+    std::vector<Ch > iext_;
+    std::vector<Och> iint_;
+    size_t ipending_;
+    std::vector<Och> oint_;
+    std::vector<Ch > oext_;
+};
+
+typedef basic_transcoding_streambuf<utf8, utf16> transcoding_streambuf_u16;
+typedef basic_transcoding_streambuf<utf8, utf32> transcoding_streambuf_u32;
+typedef basic_transcoding_streambuf<utf8, utfw, char, wchar_t> transcoding_streambuf_w;
+
+}}
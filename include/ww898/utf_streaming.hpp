@@ -0,0 +1,129 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace ww898 {
+namespace utf {
+
+static size_t const default_streaming_threshold = 64 * 1024 * 1024;
+
+namespace detail {
+
+#if defined(WW898_UTF_SSE2)
+static size_t const streaming_buffer_bytes = 16 * 1024;
+
+namespace simd {
+
+// Note: The destination must be aligned to 16 bytes, gives the number of the stored bytes.
+inline size_t stream_blocks(char * const optr, char const * const ptr, size_t const size) throw()
+{
+    size_t offset = 0;
+    for (; size - offset >= block_size; offset += block_size)
+        _mm_stream_si128(
+            reinterpret_cast<__m128i *>(optr + offset),
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr + offset)));
+    return offset;
+}
+
+// Note: The non-temporal stores are weakly ordered, the fence makes them visible before the return or the throw.
+struct stream_fence final
+{
+    stream_fence() throw() {}
+
+    stream_fence(stream_fence const &) = delete;
+    stream_fence & operator=(stream_fence const &) = delete;
+
+    ~stream_fence()
+    {
+        _mm_sfence();
+    }
+};
+
+}
+
+// Note: Every chunk is converted into the staging buffer which stays in L1 and copied to the output by the
+//       non-temporal stores, so the output doesn't evict the caches. The input is read in order, the hardware prefetch
+//       keeps up with it better than the software one. The bytes before the first aligned block of the
+//       output are copied by the regular stores, the bytes after the last one wait in the buffer for the next chunk.
+template<
+    typename Utf,
+    typename Outf,
+    typename Ch,
+    typename Och>
+Och * conv_streaming_blocks(Ch const * it, Ch const * const eit, Och * const optr)
+{
+    static size_t const buffer_size = streaming_buffer_bytes / sizeof(Och);
+    static size_t const chunk_size = (buffer_size - simd::block_size / sizeof(Och)) / Outf::max_supported_symbol_size;
+    simd::stream_fence const fence;
+    Och units[buffer_size];
+    auto obptr = reinterpret_cast<char *>(optr);
+    size_t pending = 0;
+    while (it != eit)
+    {
+        auto const cit = static_cast<size_t>(eit - it) > chunk_size
+            ? boundary<Utf>::complete_end(it, it + chunk_size)
+            : eit;
+        auto const bytes = sizeof(Och) * static_cast<size_t>(conv<Utf, Outf>(it, cit, units + pending) - units);
+        auto const bptr = reinterpret_cast<char const *>(units);
+        auto const head = std::min(bytes, static_cast<size_t>(-reinterpret_cast<uintptr_t>(obptr)) & (simd::block_size - 1));
+        std::memcpy(obptr, bptr, head);
+        auto const stored = head + simd::stream_blocks(obptr + head, bptr + head, bytes - head);
+        obptr += stored;
+        pending = (bytes - stored) / sizeof(Och);
+        std::memmove(units, units + stored / sizeof(Och), sizeof(Och) * pending);
+        it = cit;
+    }
+    std::memcpy(obptr, units, sizeof(Och) * pending);
+    return reinterpret_cast<Och *>(obptr) + pending;
+}
+#endif
+
+}
+
+// Note: Converts the huge buffer without the eviction of the caches of the other work on the core. The output of the
+//       input of at least threshold bytes is written by the non-temporal stores, the smaller input is converted by
+//       conv(). The output is not in the caches after the conversion, so the streaming suits the buffers much larger
+//       than the last level cache.
+template<
+    typename Utf,
+    typename Outf,
+    typename Ch,
+    typename Och>
+Och * conv_streaming(Ch const * const it, Ch const * const eit, Och * const optr,
+    size_t const threshold = default_streaming_threshold)
+{
+#if defined(WW898_UTF_SSE2)
+    if (sizeof(Ch) * static_cast<size_t>(eit - it) >= threshold)
+        return detail::conv_streaming_blocks<Utf, Outf>(it, eit, optr);
+#endif
+    return conv<Utf, Outf>(it, eit, optr);
+}
+
+}}
@@ -0,0 +1,168 @@
+﻿/*
+ * MIT License
+ * 
+ * Copyright (c) 2017-2018 Mikhail Pilin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <ww898/utf_converters.hpp>
+#include <ww898/utf_width_tables.hpp>
+
+#include <limits>
+
+namespace ww898 {
+namespace utf {
+
+// Note: Gives the terminal column width of the code point like wcwidth(): 0 for the controls, the combining marks and
+//       the format characters, 2 for the East Asian Wide and Fullwidth ones (CJK, Hangul syllables, most emoji) and 1
+//       for the rest.
+inline size_t code_point_width(uint32_t const cp) throw()
+{
+    typedef detail::width_tables<> tables;
+    if (cp > tables::max_code_point)
+        return 1;
+    auto const index = static_cast<size_t>(tables::stage1[cp >> tables::block_shift]) << tables::block_shift |
+        (cp & ((1u << tables::block_shift) - 1));
+    auto const stored = tables::stage2[index >> 2] >> ((index & 3) << 1) & 3;
+    // Note: The stored values 0, 1 and 2 are the widths 1, 2 and 0.
+    return 0x021u >> (stored << 2) & 0xF;
+}
+
+namespace detail {
+
+// Note: The blocks are tried again after this number of the symbols.
+static size_t const width_scalar_steps = 16;
+
+#if defined(WW898_UTF_SSE2)
+namespace simd {
+
+// Note: Checks that 16 code units are the printable ASCII symbols, each of them is 1 column wide.
+template<
+    typename Ch>
+bool printable_ascii(Ch const * const ptr) throw()
+{
+    __m128i v;
+    if (!load_ascii(ptr, v))
+        return false;
+    auto const controls = _mm_or_si128(
+        _mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+    return _mm_movemask_epi8(controls) == 0;
+}
+
+}
+#endif
+
+template<
+    typename Utf,
+    typename It>
+It skip_printable(It const it, It const, size_t &, size_t, std::false_type) throw()
+{
+    return it;
+}
+
+// Note: Skips the blocks of the printable ASCII symbols while they fit into the columns.
+template<
+    typename Utf,
+    typename It>
+It skip_printable(It it, It const eit, size_t & width, size_t const columns, std::true_type) throw()
+{
+#if defined(WW898_UTF_SSE2)
+    while (static_cast<size_t>(eit - it) >= simd::block_size &&
+           columns - width >= simd::block_size &&
+           simd::printable_ascii(it))
+    {
+        it += simd::block_size;
+        width += simd::block_size;
+    }
+#endif
+    return it;
+}
+
+}
+
+// Note: The width of the text is the sum of the widths of its code points, no temporary buffer is used.
+template<
+    typename Utf,
+    typename It>
+size_t display_width(It it, It const eit)
+{
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    size_t width = 0;
+    while (it != eit)
+    {
+        it = detail::skip_printable<Utf>(it, eit, width, std::numeric_limits<size_t>::max(),
+            detail::is_unit_pointer<Utf, It>());
+        for (auto n = detail::width_scalar_steps; n-- > 0 && it != eit;)
+            width += code_point_width(Utf::read(it, verify_fn));
+    }
+    return width;
+}
+
+// Note: Gives the position to cut the text at, so it takes at most the columns. The zero width code points after the
+//       last taken one are kept with it, the wide symbol which would cross the limit is cut off whole.
+template<
+    typename Utf,
+    typename It>
+It truncate_width(It it, It const eit, size_t const columns)
+{
+    auto const verify_fn = [&eit] (It & it)
+        {
+            if (it == eit)
+                throw std::runtime_error("Not enough input");
+        };
+    size_t width = 0;
+    while (it != eit)
+    {
+        it = detail::skip_printable<Utf>(it, eit, width, columns, detail::is_unit_pointer<Utf, It>());
+        for (auto n = detail::width_scalar_steps; n-- > 0 && it != eit;)
+        {
+            auto const cut = it;
+            auto const symbol_width = code_point_width(Utf::read(it, verify_fn));
+            if (symbol_width > columns - width)
+                return cut;
+            width += symbol_width;
+        }
+    }
+    return it;
+}
+
+template<
+    typename Ch>
+size_t display_width(std::basic_string<Ch> const & str)
+{
+    return display_width<utf_selector_t<Ch>>(str.data(), str.data() + str.size());
+}
+
+// Note: Gives the number of the code units to keep.
+template<
+    typename Ch>
+size_t truncate_width(std::basic_string<Ch> const & str, size_t const columns)
+{
+    return truncate_width<utf_selector_t<Ch>>(str.data(), str.data() + str.size(), columns) - str.data();
+}
+
+}}
@@ -29,6 +29,18 @@
 #endif
 
 #include <ww898/utf_converters.hpp>
+#include <ww898/utf_streambuf.hpp>
+#include <ww898/utf_batch.hpp>
+#include <ww898/utf_pipeline.hpp>
+#include <ww898/utf_offsets.hpp>
+#include <ww898/utf_nfc.hpp>
+#include <ww898/utf_width.hpp>
+#include <ww898/utf_compact_string.hpp>
+#include <ww898/utf_rope.hpp>
+#include <ww898/utf_cache.hpp>
+#include <ww898/utf_in_place.hpp>
+#include <ww898/utf_fanout.hpp>
+#include <ww898/utf_streaming.hpp>
 
 #if defined(_WIN32)
 #include <windows.h>
@@ -48,6 +60,10 @@
 #include <iostream>
 #include <iomanip>
 #include <codecvt>
+#include <sstream>
+#include <functional>
+#include <list>
+#include <algorithm>
 
 #if defined(__linux__) || defined(__APPLE__)
 #include <chrono>
@@ -59,6 +75,22 @@
 
 #endif
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#if defined(__GLIBC__)
+#include <iconv.h>
+#endif
+
+#include <clocale>
+#include <cstdlib>
+
 namespace ww898 {
 namespace test {
 
@@ -417,9 +449,13 @@ void run_conv_test(
     utf::convz<utf_type, outf_type>(buf.data(), std::back_inserter(buf_tmp0));
     std::basic_string<Och> buf_tmp1;
     utf::conv<utf_type, outf_type>(buf.cbegin(), buf.cend(), std::back_inserter(buf_tmp1));
+    std::basic_string<Och> buf_tmp2;
+    utf::conv_unchecked<utf_type, outf_type>(buf.cbegin(), buf.cend(), std::back_inserter(buf_tmp2));
     auto const success =
         obuf == buf_tmp0 &&
-        obuf == buf_tmp1;
+        obuf == buf_tmp1 &&
+        obuf == buf_tmp2 &&
+        obuf == utf::conv_unchecked<Och>(buf);
     BOOST_TEST_REQUIRE(success);
 }
 
@@ -447,6 +483,51 @@ void run_size_test(
     BOOST_TEST_REQUIRE(buf.size() == total_size2);
 }
 
+template<
+    typename Ch,
+    typename Och>
+void run_compare_test(
+    std::basic_string<Ch> const & buf,
+    std::basic_string<Och> const & obuf)
+{
+    typedef utf::utf_selector_t<Ch> utf_type;
+    typedef utf::utf_selector_t<Och> outf_type;
+
+    BOOST_TEST_REQUIRE(utf::compare(buf, obuf) == 0);
+    BOOST_TEST_REQUIRE(utf::equal(buf, obuf));
+    BOOST_TEST_REQUIRE((utf::compare<utf_type, outf_type>(buf.cbegin(), buf.cend(), obuf.cbegin(), obuf.cend()) == 0));
+
+    auto const longer = obuf + obuf;
+    BOOST_TEST_REQUIRE(utf::compare(buf, longer) < 0);
+    BOOST_TEST_REQUIRE(utf::compare(longer, buf) > 0);
+    BOOST_TEST_REQUIRE(!utf::equal(buf, longer));
+}
+
+template<
+    typename Ch,
+    typename Och>
+void run_compare_block_test()
+{
+    static size_t const length = 100;
+    std::u32string u32;
+    for (size_t n = 0; n < length; ++n)
+        u32.push_back(static_cast<char32_t>('a' + n % 26));
+    auto const buf = utf::conv<Ch>(u32);
+    auto const obuf = utf::conv<Och>(u32);
+    BOOST_TEST_REQUIRE(utf::equal(buf, obuf));
+    for (size_t n = 0; n < length; ++n)
+    {
+        for (auto const cp : { 0x41u, 0xE9u, 0x1F600u })
+        {
+            auto other = u32;
+            other[n] = cp;
+            auto const sign = cp < u32[n] ? -1 : 1;
+            BOOST_TEST_REQUIRE(utf::compare(utf::conv<Ch>(other), obuf) == sign);
+            BOOST_TEST_REQUIRE(utf::compare(buf, utf::conv<Och>(other)) == -sign);
+        }
+    }
+}
+
 }
 
 BOOST_DATA_TEST_CASE(conv_u8_to_u8  , boost::make_iterator_range(unicode_test_data), tuple) { run_conv_test(tuple.u8 , tuple.u8 ); }
@@ -477,6 +558,1015 @@ BOOST_DATA_TEST_CASE(size_uw , boost::make_iterator_range(unicode_test_data), tu
 BOOST_DATA_TEST_CASE(size_u8_supported , boost::make_iterator_range(supported_test_data), tuple) { run_size_test(tuple.u8 ); }
 BOOST_DATA_TEST_CASE(size_u32_supported, boost::make_iterator_range(supported_test_data), tuple) { run_size_test(tuple.u32); }
 
+BOOST_DATA_TEST_CASE(compare_u8_to_u8  , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u8 , tuple.u8 ); }
+BOOST_DATA_TEST_CASE(compare_u8_to_u16 , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u8 , tuple.u16); }
+BOOST_DATA_TEST_CASE(compare_u8_to_u32 , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u8 , tuple.u32); }
+BOOST_DATA_TEST_CASE(compare_u8_to_uw  , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u8 , tuple.uw ); }
+BOOST_DATA_TEST_CASE(compare_u16_to_u16, boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u16, tuple.u16); }
+BOOST_DATA_TEST_CASE(compare_u16_to_u32, boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u16, tuple.u32); }
+BOOST_DATA_TEST_CASE(compare_u16_to_uw , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u16, tuple.uw ); }
+BOOST_DATA_TEST_CASE(compare_u32_to_u32, boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u32, tuple.u32); }
+BOOST_DATA_TEST_CASE(compare_u32_to_uw , boost::make_iterator_range(unicode_test_data), tuple) { run_compare_test(tuple.u32, tuple.uw ); }
+
+BOOST_AUTO_TEST_CASE(compare_blocks)
+{
+    run_compare_block_test<char    , char16_t>();
+    run_compare_block_test<char    , char32_t>();
+    run_compare_block_test<char16_t, char    >();
+    run_compare_block_test<char16_t, char32_t>();
+    run_compare_block_test<char32_t, char    >();
+    run_compare_block_test<wchar_t , char    >();
+}
+
+BOOST_AUTO_TEST_CASE(compare_surrogates)
+{
+    // Note: 0xFFFF < 0x10000 in code point order, but 0xFFFF > 0xD800 in UTF16 code unit order.
+    std::u16string const u16_bmp{ 0xFFFF };
+    std::u16string const u16_sup{ 0xD800, 0xDC00 };
+    std::string const u8_sup{ '\xF0', '\x90', '\x80', '\x80' };
+    std::u32string const u32_bmp{ 0xFFFF };
+    BOOST_TEST_REQUIRE(utf::compare(u16_bmp, u16_sup) < 0);
+    BOOST_TEST_REQUIRE(utf::compare(u16_sup, u16_bmp) > 0);
+    BOOST_TEST_REQUIRE(utf::compare(u16_bmp, u8_sup) < 0);
+    BOOST_TEST_REQUIRE(utf::compare(u8_sup, u32_bmp) > 0);
+    BOOST_TEST_REQUIRE(utf::equal(u8_sup, u16_sup));
+}
+
+BOOST_DATA_TEST_CASE(hash_unicode, boost::make_iterator_range(unicode_test_data), tuple)
+{
+    auto const u8_hash = utf::hash(tuple.u8);
+    BOOST_TEST_REQUIRE(u8_hash == utf::hash(tuple.u16));
+    BOOST_TEST_REQUIRE(u8_hash == utf::hash(tuple.u32));
+    BOOST_TEST_REQUIRE(u8_hash == utf::hash(tuple.uw ));
+    BOOST_TEST_REQUIRE(u8_hash == utf::hash<utf::utf8>(tuple.u8.cbegin(), tuple.u8.cend()));
+}
+
+BOOST_AUTO_TEST_CASE(hash_blocks)
+{
+    std::u32string u32;
+    for (size_t n = 0; n < 40; ++n)
+        u32.push_back(static_cast<char32_t>('a' + n % 26));
+    for (size_t n = 0; n < 40; ++n)
+        u32.push_back(static_cast<char32_t>(0x0430 + n % 32));
+    for (size_t n = 0; n < 3; ++n)
+        u32.push_back(static_cast<char32_t>(0x1F600 + n));
+    for (size_t n = 0; n < 40; ++n)
+        u32.push_back(static_cast<char32_t>('0' + n % 10));
+
+    for (size_t length = 0; length <= u32.size(); ++length)
+    {
+        auto const str = u32.substr(0, length);
+        auto const u32_hash = utf::hash(str);
+        BOOST_TEST_REQUIRE(u32_hash == utf::hash(utf::conv<char    >(str)));
+        BOOST_TEST_REQUIRE(u32_hash == utf::hash(utf::conv<char16_t>(str)));
+        BOOST_TEST_REQUIRE(u32_hash == utf::hash(utf::conv<wchar_t >(str)));
+        BOOST_TEST_REQUIRE(u32_hash == utf::hash<utf::utf32>(str.cbegin(), str.cend()));
+        if (length > 0)
+            BOOST_TEST_REQUIRE(u32_hash != utf::hash(u32.substr(0, length - 1)));
+    }
+
+    utf::code_point_hash const hash_fn;
+    utf::code_point_equal const equal_fn;
+    auto const u8 = utf::conv<char>(u32);
+    BOOST_TEST_REQUIRE(hash_fn(u8) == hash_fn(utf::conv<char16_t>(u8)));
+    BOOST_TEST_REQUIRE(equal_fn(u8, utf::conv<char16_t>(u8)));
+    BOOST_TEST_REQUIRE(!equal_fn(u8, u32.substr(1)));
+}
+
+namespace {
+
+template<
+    typename ReadFn>
+bool try_read(std::string const & buf, ReadFn && read_fn, uint32_t & cp, size_t & size)
+{
+    auto it = buf.cbegin();
+    auto const eit = buf.cend();
+    try
+    {
+        cp = read_fn(it, [&eit] (std::string::const_iterator & it)
+            {
+                if (it == eit)
+                    throw std::runtime_error("Not enough input");
+            });
+        size = static_cast<size_t>(it - buf.cbegin());
+        return true;
+    }
+    catch (std::runtime_error const &)
+    {
+        return false;
+    }
+}
+
+void run_dfa_test(std::string const & buf)
+{
+    typedef std::string::const_iterator it_type;
+    typedef std::function<void (it_type &)> verify_type;
+
+    uint32_t cp0 = 0, cp1 = 0, cp2 = 0;
+    size_t size0 = 0, size1 = 0, size2 = 0;
+    auto const valid0 = try_read(buf, [] (it_type & it, verify_type const & verify_fn) { return utf::utf8::read(it, verify_fn); }, cp0, size0);
+    auto const valid1 = try_read(buf, [] (it_type & it, verify_type const & verify_fn) { return utf::utf8::read_dfa(it, verify_fn); }, cp1, size1);
+    BOOST_TEST_REQUIRE(valid0 == valid1);
+    if (valid0)
+        BOOST_TEST_REQUIRE((cp0 == cp1 && size0 == size1));
+
+    std::string shortest;
+    if (valid0)
+    {
+        auto oit = std::back_inserter(shortest);
+        utf::utf8::write(cp0, oit);
+    }
+    auto const strict = valid0 && size0 == shortest.size() && !utf::is_surrogate(cp0) && cp0 <= utf::max_unicode_code_point;
+    auto const valid2 = try_read(buf, [] (it_type & it, verify_type const & verify_fn) { return utf::utf8_strict::read(it, verify_fn); }, cp2, size2);
+    BOOST_TEST_REQUIRE(strict == valid2);
+    if (strict)
+        BOOST_TEST_REQUIRE((cp0 == cp2 && size0 == size2));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(utf8_dfa)
+{
+    static uint8_t const tails[] = { 0x7F, 0x80, 0x8F, 0x90, 0xA0, 0xBF, 0xC0 };
+    std::string buf(6, '\x80');
+    for (size_t ch0 = 0; ch0 < 0x100; ++ch0)
+        for (size_t ch1 = 0; ch1 < 0x100; ++ch1)
+        {
+            buf[0] = static_cast<char>(ch0);
+            buf[1] = static_cast<char>(ch1);
+            for (auto const ch2 : tails)
+            {
+                buf[2] = static_cast<char>(ch2);
+                for (auto const ch3 : tails)
+                {
+                    buf[3] = static_cast<char>(ch3);
+                    run_dfa_test(buf);
+                    if (ch0 < 0xF0)
+                        break;
+                }
+                run_dfa_test(buf.substr(0, 3));
+                if (ch0 < 0xE0)
+                    break;
+            }
+            run_dfa_test(buf.substr(0, 2));
+        }
+    run_dfa_test(std::string());
+}
+
+BOOST_DATA_TEST_CASE(conv_u8_strict_to_u32, boost::make_iterator_range(unicode_test_data), tuple)
+{
+    std::u32string u32;
+    utf::conv<utf::utf8_strict, utf::utf32>(tuple.u8.cbegin(), tuple.u8.cend(), std::back_inserter(u32));
+    BOOST_TEST_REQUIRE((u32 == tuple.u32));
+    std::string u8;
+    utf::conv<utf::utf32, utf::utf8_strict>(tuple.u32.cbegin(), tuple.u32.cend(), std::back_inserter(u8));
+    BOOST_TEST_REQUIRE((u8 == tuple.u8));
+    BOOST_TEST_REQUIRE((utf::size<utf::utf8_strict>(tuple.u8.cbegin(), tuple.u8.cend()) == tuple.u8.size()));
+}
+
+BOOST_DATA_TEST_CASE(conv_u8_strict_unsupported, boost::make_iterator_range(supported_test_data), tuple)
+{
+    std::u32string u32;
+    BOOST_CHECK_THROW((utf::conv<utf::utf8_strict, utf::utf32>(tuple.u8.cbegin(), tuple.u8.cend(), std::back_inserter(u32))), std::runtime_error);
+    std::string u8;
+    BOOST_CHECK_THROW((utf::conv<utf::utf32, utf::utf8_strict>(tuple.u32.cbegin(), tuple.u32.cend(), std::back_inserter(u8))), std::runtime_error);
+}
+
+namespace {
+
+template<
+    typename Utf,
+    typename Ch>
+void run_wide_store_test(std::basic_string<Ch> const & str, std::string const & expected)
+{
+    // Note: The buffer has the exact size of the output with guard bytes after it.
+    std::string buf(expected.size() + 4, '\x55');
+    auto const eptr = utf::conv<Utf, utf::utf8>(str.data(), str.data() + str.size(), &buf[0]);
+    BOOST_TEST_REQUIRE((eptr == &buf[0] + expected.size()));
+    BOOST_TEST_REQUIRE((buf.substr(0, expected.size()) == expected));
+    BOOST_TEST_REQUIRE((buf.substr(expected.size()) == std::string(4, '\x55')));
+}
+
+}
+
+BOOST_DATA_TEST_CASE(wide_store_unicode, boost::make_iterator_range(unicode_test_data), tuple)
+{
+    run_wide_store_test<utf::utf16>(tuple.u16, tuple.u8);
+    run_wide_store_test<utf::utf32>(tuple.u32, tuple.u8);
+}
+
+BOOST_AUTO_TEST_CASE(wide_store_random)
+{
+    static uint32_t const limits[] = { 0x80, 0x800, 0x10000, 0x110000, 0x200000, 0x4000000, 0x80000000 };
+    boost::random::mt19937 random(0);
+    for (size_t n = 0; n < 64; ++n)
+    {
+        std::u32string u32;
+        std::string u8;
+        auto oit = std::back_inserter(u8);
+        for (auto size = n; size-- > 0; )
+        {
+            auto const cp = random() % limits[random() % (sizeof(limits) / sizeof(limits[0]))];
+            u32.push_back(cp);
+            utf::utf8::write(cp, oit);
+        }
+        run_wide_store_test<utf::utf32>(u32, u8);
+    }
+}
+
+namespace {
+
+// Note: Reference escaping by code points.
+std::string escape_json(std::u32string const & u32, bool const ascii)
+{
+    std::string res;
+    char tmp[16];
+    for (auto const cp : u32)
+    {
+        if (cp == '"' || cp == '\\')
+            res += {'\\', static_cast<char>(cp)};
+        else if (cp == '\n')
+            res += "\\n";
+        else if (cp == '\t')
+            res += "\\t";
+        else if (cp == '\r')
+            res += "\\r";
+        else if (cp == '\b')
+            res += "\\b";
+        else if (cp == '\f')
+            res += "\\f";
+        else if (cp < 0x20 || (ascii && 0x80 <= cp && cp < 0x10000))
+        {
+            snprintf(tmp, sizeof(tmp), "\\u%04x", static_cast<unsigned>(cp));
+            res += tmp;
+        }
+        else if (ascii && cp >= 0x10000)
+        {
+            snprintf(tmp, sizeof(tmp), "\\u%04x\\u%04x",
+                static_cast<unsigned>(0xD800 + ((cp - 0x10000) >> 10)),
+                static_cast<unsigned>(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+            res += tmp;
+        }
+        else
+            res += utf::conv<char>(std::u32string(1, cp));
+    }
+    return res;
+}
+
+template<
+    typename Outf,
+    typename Ch>
+void run_json_test(std::basic_string<Ch> const & str, std::string const & expected)
+{
+    std::string res;
+    utf::conv<utf::utf_selector_t<Ch>, Outf>(str.cbegin(), str.cend(), std::back_inserter(res));
+    BOOST_TEST_REQUIRE((res == expected));
+    std::string buf(expected.size(), '\0');
+    BOOST_TEST_REQUIRE((utf::conv<utf::utf_selector_t<Ch>, Outf>(str.data(), str.data() + str.size(), &buf[0]) == &buf[0] + buf.size()));
+    BOOST_TEST_REQUIRE((buf == expected));
+}
+
+}
+
+BOOST_DATA_TEST_CASE(conv_json, boost::make_iterator_range(unicode_test_data), tuple)
+{
+    run_json_test<utf::utf8_json>(tuple.u8, tuple.u8);
+    run_json_test<utf::utf8_json>(tuple.u16, tuple.u8);
+    run_json_test<utf::utf8_json_ascii>(tuple.u32, escape_json(tuple.u32, true));
+}
+
+BOOST_AUTO_TEST_CASE(conv_json_escapes)
+{
+    // Note: The escaped symbols are placed at every position of the blocks.
+    static char32_t const specials[] = { '"', '\\', '\n', '\t', '\r', '\b', '\f', 0x00, 0x1F, 0x7F, 0xE9, 0x20AC, 0x1F600 };
+    for (auto const cp : specials)
+        for (size_t pos = 0; pos < 40; ++pos)
+        {
+            std::u32string u32(40, 'a');
+            u32[pos] = cp;
+            auto const u16 = utf::conv<char16_t>(u32);
+            run_json_test<utf::utf8_json>(u32, escape_json(u32, false));
+            run_json_test<utf::utf8_json>(u16, escape_json(u32, false));
+            run_json_test<utf::utf8_json_ascii>(u16, escape_json(u32, true));
+            run_json_test<utf::utf8_json_ascii>(utf::conv<char>(u32), escape_json(u32, true));
+        }
+    std::string u8;
+    BOOST_CHECK_THROW((utf::conv<utf::utf8_json_ascii>(std::u32string(1, 0x110000), std::back_inserter(u8))), std::runtime_error);
+}
+
+namespace {
+
+// Note: Checks every offset against the symbol boundaries found by the conversion of the code points one by one.
+template<
+    typename Utf,
+    typename Ch>
+void run_offset_test(std::basic_string<Ch> const & str, std::u32string const & u32)
+{
+    std::vector<utf::text_offset> boundaries(1, utf::text_offset{ 0, 0, 0 });
+    for (auto const cp : u32)
+    {
+        auto next = boundaries.back();
+        next.u8 += utf::conv<char>(std::u32string(1, cp)).size();
+        next.u16 += utf::conv<char16_t>(std::u32string(1, cp)).size();
+        ++next.cp;
+        boundaries.push_back(next);
+    }
+    auto const beg = str.data();
+    auto const end = beg + str.size();
+    std::vector<size_t> u16_offsets;
+    std::vector<utf::text_offset> expected;
+    for (size_t offset = 0; offset <= boundaries.back().u16 + 1; ++offset)
+    {
+        auto b = boundaries.size();
+        while (boundaries[--b].u16 > offset) {}
+        BOOST_TEST_REQUIRE((utf::find_offset<Utf, utf::utf16>(beg, end, offset) == boundaries[b]));
+        u16_offsets.push_back(offset);
+        expected.push_back(boundaries[b]);
+    }
+    std::vector<utf::text_offset> found;
+    utf::find_offsets<Utf, utf::utf16>(beg, end, u16_offsets.cbegin(), u16_offsets.cend(), std::back_inserter(found));
+    BOOST_TEST_REQUIRE((found == expected));
+    for (auto const & boundary : boundaries)
+    {
+        BOOST_TEST_REQUIRE((utf::conv_offset<Utf, utf::utf8 , utf::utf16>(beg, end, boundary.u8 ) == boundary.u16));
+        BOOST_TEST_REQUIRE((utf::conv_offset<Utf, utf::utf16, utf::utf8 >(beg, end, boundary.u16) == boundary.u8 ));
+        BOOST_TEST_REQUIRE((utf::conv_offset<Utf, utf::utf32, utf::utf8 >(beg, end, boundary.cp ) == boundary.u8 ));
+    }
+}
+
+}
+
+BOOST_DATA_TEST_CASE(find_offset_unicode, boost::make_iterator_range(unicode_test_data), tuple)
+{
+    run_offset_test<utf::utf8 >(tuple.u8 , tuple.u32);
+    run_offset_test<utf::utf16>(tuple.u16, tuple.u32);
+}
+
+BOOST_AUTO_TEST_CASE(find_offset_blocks)
+{
+    std::u32string u32;
+    for (size_t n = 0; n < 8; ++n)
+        u32 += std::u32string(37, 'a') + U"\u00e9\u20ac" + std::u32string(21, 'b') + U"\U0001F600";
+    run_offset_test<utf::utf8 >(utf::conv<char>(u32), u32);
+    run_offset_test<utf::utf16>(utf::conv<char16_t>(u32), u32);
+    run_offset_test<utf::utf32>(u32, u32);
+
+    auto const u8 = utf::conv<char>(u32);
+    std::vector<size_t> const offsets = { 2, 1 };
+    std::vector<utf::text_offset> found;
+    BOOST_CHECK_THROW((utf::find_offsets<utf::utf8, utf::utf8>(u8.data(), u8.data() + u8.size(), offsets.cbegin(), offsets.cend(),
+        std::back_inserter(found))), std::invalid_argument);
+    std::string const invalid{ '\x61', '\x82' };
+    BOOST_CHECK_THROW((utf::conv_offset<utf::utf16, utf::utf8>(invalid, 2)), std::runtime_error);
+}
+
+namespace {
+
+// Note: The list iterators don't take the blocks, the conversion by the symbols is the reference.
+void run_nfc_test(std::u32string const & u32, utf::nfc_quick_check const expected)
+{
+    auto const u8 = utf::conv<char>(u32);
+    auto const u16 = utf::conv<char16_t>(u32);
+    std::list<char> const list(u8.cbegin(), u8.cend());
+    BOOST_TEST_REQUIRE((utf::is_nfc_quick(u8) == expected));
+    BOOST_TEST_REQUIRE((utf::is_nfc_quick(u16) == expected));
+    BOOST_TEST_REQUIRE((utf::is_nfc_quick(u32) == expected));
+    BOOST_TEST_REQUIRE((utf::is_nfc_quick<utf::utf8>(list.cbegin(), list.cend()) == expected));
+    auto result = utf::nfc_quick_check::yes;
+    BOOST_TEST_REQUIRE((utf::conv_nfc_check<char16_t>(u8, result) == u16));
+    BOOST_TEST_REQUIRE((result == expected));
+    result = utf::nfc_quick_check::yes;
+    BOOST_TEST_REQUIRE((utf::conv_nfc_check<char>(u32, result) == u8));
+    BOOST_TEST_REQUIRE((result == expected));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(nfc_quick_check)
+{
+    run_nfc_test(U"", utf::nfc_quick_check::yes);
+    run_nfc_test(U"Caf\u00E9 \u0434\u043E\u043C \u4E00 \U0001F600 \uAC00", utf::nfc_quick_check::yes);
+    run_nfc_test(U"a\u0327\u0301", utf::nfc_quick_check::maybe);
+    run_nfc_test(U"\u1100\u1161", utf::nfc_quick_check::maybe);
+    run_nfc_test(U"a\u0301\u0327", utf::nfc_quick_check::no);
+    run_nfc_test(U"\u212B", utf::nfc_quick_check::no);
+    run_nfc_test(U"e\u0344", utf::nfc_quick_check::no);
+    run_nfc_test(U"\U0002F800", utf::nfc_quick_check::no);
+    // Note: The blocks of the Latin-1 symbols end inside the symbols and before the combining marks.
+    for (size_t size = 0; size < 40; ++size)
+    {
+        std::u32string latin;
+        for (size_t n = 0; n < size; ++n)
+            latin.push_back(n % 3 == 0 ? 'a' + n % 26 : 0xC0 + n % 48);
+        run_nfc_test(latin + U"\u0301", utf::nfc_quick_check::maybe);
+        run_nfc_test(latin + U"\u0301\u0316" + latin, utf::nfc_quick_check::no);
+        run_nfc_test(latin + U"\u0316\u0301" + latin, utf::nfc_quick_check::maybe);
+    }
+    std::string const invalid("abc\xCC");
+    BOOST_CHECK_THROW(utf::is_nfc_quick(invalid), std::runtime_error);
+}
+
+namespace {
+
+void run_width_test(std::u32string const & u32, size_t const expected)
+{
+    auto const u8 = utf::conv<char>(u32);
+    auto const u16 = utf::conv<char16_t>(u32);
+    std::list<char16_t> const list(u16.cbegin(), u16.cend());
+    BOOST_TEST_REQUIRE(utf::display_width(u8) == expected);
+    BOOST_TEST_REQUIRE(utf::display_width(u16) == expected);
+    BOOST_TEST_REQUIRE(utf::display_width(u32) == expected);
+    BOOST_TEST_REQUIRE((utf::display_width<utf::utf16>(list.cbegin(), list.cend()) == expected));
+    for (size_t columns = 0; columns <= expected + 1; ++columns)
+    {
+        auto const cut = u32.substr(0, utf::truncate_width(u32, columns));
+        BOOST_TEST_REQUIRE(utf::display_width(cut) <= columns);
+        BOOST_TEST_REQUIRE((utf::conv<char32_t>(u8.substr(0, utf::truncate_width(u8, columns))) == cut));
+        BOOST_TEST_REQUIRE((utf::conv<char32_t>(u16.substr(0, utf::truncate_width(u16, columns))) == cut));
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(display_width)
+{
+    BOOST_TEST(utf::code_point_width('a') == 1u);
+    BOOST_TEST(utf::code_point_width('\t') == 0u);
+    BOOST_TEST(utf::code_point_width(0x0301) == 0u);
+    BOOST_TEST(utf::code_point_width(0x200B) == 0u);
+    BOOST_TEST(utf::code_point_width(0x00AD) == 1u);
+    BOOST_TEST(utf::code_point_width(0x4E00) == 2u);
+    BOOST_TEST(utf::code_point_width(0xFF21) == 2u);
+    BOOST_TEST(utf::code_point_width(0x1F600) == 2u);
+    BOOST_TEST(utf::code_point_width(0x2FFFD) == 2u);
+    BOOST_TEST(utf::code_point_width(0xE0100) == 0u);
+    BOOST_TEST(utf::code_point_width(0x10FFFF) == 1u);
+    run_width_test(U"", 0);
+    run_width_test(U"Caf\u00E9 \u0434\u043E\u043C", 8);
+    run_width_test(U"e\u0301\u0327x", 2);
+    run_width_test(U"\u4E00\u4E8C\u4E09\U0001F600", 8);
+    run_width_test(U"\u1100\u1161\u11A8\uAC00", 4);
+    // Note: The blocks of the printable ASCII symbols are cut at every column and stop at the controls.
+    for (size_t size = 0; size < 40; ++size)
+    {
+        std::u32string ascii;
+        for (size_t n = 0; n < size; ++n)
+            ascii.push_back(n == 20 ? '\t' : ' ' + n % 95);
+        auto const width = size > 20 ? size - 1 : size;
+        run_width_test(ascii, width);
+        run_width_test(ascii + U"\u4E00" + ascii, 2 * width + 2);
+        run_width_test(ascii + U"\u0301\u0301" + ascii, 2 * width);
+    }
+    std::string const invalid("abc\xE4\xB8");
+    BOOST_CHECK_THROW(utf::display_width(invalid), std::runtime_error);
+}
+
+namespace {
+
+void run_compact_test(std::u32string const & u32, size_t const unit_size)
+{
+    auto const u8 = utf::conv<char>(u32);
+    auto const u16 = utf::conv<char16_t>(u32);
+    std::list<char> const list(u8.cbegin(), u8.cend());
+    utf::compact_string from_list;
+    from_list.assign<utf::utf8>(list.cbegin(), list.cend());
+    for (auto const & str : {utf::compact_string(u8), utf::compact_string(u16), utf::compact_string(u32), from_list})
+    {
+        BOOST_TEST_REQUIRE(str.size() == u32.size());
+        BOOST_TEST_REQUIRE(str.unit_size() == unit_size);
+        for (size_t n = 0; n < u32.size(); ++n)
+            BOOST_TEST_REQUIRE(str[n] == static_cast<uint32_t>(u32[n]));
+        BOOST_TEST_REQUIRE((str.str<char>() == u8));
+        BOOST_TEST_REQUIRE((str.str<char16_t>() == u16));
+        BOOST_TEST_REQUIRE((str.str<char32_t>() == u32));
+        BOOST_TEST_REQUIRE((str == from_list));
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(compact_string)
+{
+    // Note: The special symbols stand at every position of the blocks.
+    for (size_t size = 0; size < 40; ++size)
+    {
+        std::u32string ascii;
+        for (size_t n = 0; n < size; ++n)
+            ascii.push_back(' ' + n % 95);
+        run_compact_test(ascii, 1);
+        for (size_t pos = 0; pos <= size; ++pos)
+        {
+            run_compact_test(ascii.substr(0, pos) + U"\u00E9" + ascii.substr(pos), 1);
+            run_compact_test(ascii.substr(0, pos) + U"\u0434" + ascii.substr(pos), 2);
+            run_compact_test(ascii.substr(0, pos) + U"\uFFFD" + ascii.substr(pos), 2);
+            run_compact_test(ascii.substr(0, pos) + U"\U0001F600" + ascii.substr(pos), 4);
+        }
+    }
+    utf::compact_string str(std::string("abc"));
+    auto copy = str;
+    BOOST_TEST((copy == str));
+    auto const moved = std::move(copy);
+    BOOST_TEST((moved == str));
+    BOOST_TEST(copy.empty());
+    BOOST_TEST((moved != utf::compact_string(std::string("abd"))));
+    BOOST_CHECK_THROW(str.assign<utf::utf8>("ab\xC3", "ab\xC3" + 3), std::runtime_error);
+    BOOST_CHECK_THROW(str.assign<utf::utf8>("ab\xE4\xB8", "ab\xE4\xB8" + 4), std::runtime_error);
+    BOOST_CHECK_THROW(str.assign<utf::utf16>(u"ab\xDC00", u"ab\xDC00" + 3), std::runtime_error);
+    // Note: The surrogates and the code points above U+10FFFF are rejected by every storage.
+    for (auto const & u32 : { std::u32string{ 0xD800 }, std::u32string{ 0xD800, 0x10000 }, std::u32string{ 'a', 0x110000 } })
+        BOOST_CHECK_THROW(str.assign<utf::utf32>(u32.data(), u32.data() + u32.size()), std::runtime_error);
+    BOOST_CHECK_THROW(str.assign<utf::utf8>("\xF8\x88\x80\x80\x80", "\xF8\x88\x80\x80\x80" + 5), std::runtime_error);
+    BOOST_TEST((str.str<char>() == "abc"));
+}
+
+namespace {
+
+utf::text_metrics model_metrics(std::u32string const & u32)
+{
+    return utf::text_metrics
+        {
+            utf::conv<char>(u32).size(),
+            utf::conv<char16_t>(u32).size(),
+            u32.size(),
+            static_cast<size_t>(std::count(u32.cbegin(), u32.cend(), U'\n'))
+        };
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(rope)
+{
+    std::u32string const pieces[] =
+        {
+            U"line\n",
+            U"\u0434\u043E\u043C ",
+            U"\U0001F600",
+            U"\u4E00\n\n",
+            U"plain ascii text of some length "
+        };
+    utf::rope rope;
+    std::u32string model;
+    uint32_t seed = 1;
+    auto const next = [&seed] (size_t const n)
+        {
+            seed = seed * 1103515245 + 12345;
+            return static_cast<size_t>(seed >> 8) % n;
+        };
+    // Note: The long insertions take many chunks, the short ones are joined into the chunks around them.
+    for (size_t step = 0; step < 400; ++step)
+    {
+        auto const first = next(model.size() + 1);
+        if (next(3) != 0)
+        {
+            std::u32string text;
+            for (auto count = next(step % 25 == 0 ? 400 : 4) + 1; count-- > 0;)
+                text += pieces[next(sizeof(pieces) / sizeof(pieces[0]))];
+            if (step % 2 == 0)
+                rope.insert<utf::utf32>(first, utf::conv<char16_t>(text));
+            else
+                rope.insert<utf::utf16>(utf::conv<char16_t>(model.substr(0, first)).size(), utf::conv<char>(text));
+            model.insert(first, text);
+        }
+        else
+        {
+            auto const last = first + next(std::min<size_t>(model.size() - first, 300) + 1);
+            rope.erase<utf::utf32>(first, last);
+            model.erase(first, last - first);
+        }
+        BOOST_TEST_REQUIRE((rope.metrics() == model_metrics(model)));
+        if (step % 20 != 0)
+            continue;
+        BOOST_TEST_REQUIRE((rope.str<char32_t>() == model));
+        for (size_t n = 0; n < 10; ++n)
+        {
+            auto const cp = next(model.size() + 1);
+            auto const pos = model_metrics(model.substr(0, cp));
+            BOOST_TEST_REQUIRE((rope.find<utf::utf32>(cp) == pos));
+            BOOST_TEST_REQUIRE((rope.find<utf::utf16>(pos.u16) == pos));
+            BOOST_TEST_REQUIRE((rope.find<utf::utf8>(pos.u8) == pos));
+            BOOST_TEST_REQUIRE((rope.conv_offset<utf::utf16, utf::utf8>(pos.u16) == pos.u8));
+            auto const line = model.rfind(U'\n', cp == 0 ? 0 : cp - 1);
+            auto const line_start = cp == 0 || line == std::u32string::npos ? 0 : line + 1;
+            BOOST_TEST_REQUIRE((rope.find_line(pos.lines) == model_metrics(model.substr(0, line_start))));
+            auto const last = cp + next(model.size() - cp + 1);
+            BOOST_TEST_REQUIRE((rope.substr<utf::utf32, char>(cp, last) == utf::conv<char>(model.substr(cp, last - cp))));
+        }
+    }
+    BOOST_TEST((rope.find<utf::utf32>(model.size() + 10) == model_metrics(model)));
+    BOOST_TEST((rope.find_line(model_metrics(model).lines + 10) == model_metrics(model)));
+    auto const metrics = rope.metrics();
+    BOOST_CHECK_THROW(rope.insert<utf::utf8>(0, std::string("ab\xC3")), std::runtime_error);
+    BOOST_TEST((rope.metrics() == metrics));
+    rope.erase<utf::utf8>(0, metrics.u8);
+    BOOST_TEST(rope.empty());
+}
+
+BOOST_AUTO_TEST_CASE(conv_cache)
+{
+    // Note: The hand of CLOCK clears the used entry and evicts the next one.
+    utf::conv_cache<char16_t, char> cache(4, 1, 8);
+    auto const a = cache.conv(std::u16string(u"a\u0434"));
+    BOOST_TEST((*a == "a\xD0\xB4"));
+    BOOST_TEST((cache.conv(std::u16string(u"a\u0434")) == a));
+    cache.conv(std::u16string(u"b"));
+    cache.conv(std::u16string(u"c"));
+    cache.conv(std::u16string(u"d"));
+    cache.conv(std::u16string(u"e"));
+    BOOST_TEST((cache.conv(std::u16string(u"a\u0434")) == a));
+    auto const b = cache.conv(std::u16string(u"b"));
+    BOOST_TEST((*b == "b"));
+    BOOST_TEST((*cache.conv(std::u16string(u"long string")) == "long string"));
+    auto const stats = cache.stats();
+    BOOST_TEST(stats.hits == 2u);
+    BOOST_TEST(stats.misses == 6u);
+    BOOST_TEST(stats.bypasses == 1u);
+    BOOST_TEST(stats.evictions == 2u);
+    BOOST_CHECK_THROW(cache.conv(std::u16string(1, 0xD800)), std::runtime_error);
+    cache.clear();
+    BOOST_TEST((cache.conv(std::u16string(u"a\u0434")) != a));
+
+    utf::conv_cache<char, char32_t> shared(64, 4, 16);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> failures(0);
+    for (size_t t = 0; t < 4; ++t)
+        threads.emplace_back([&shared, &failures, t]
+            {
+                for (size_t n = 0; n < 2000; ++n)
+                {
+                    auto const value = std::to_string((n * 7 + t) % 100) + "\xE2\x82\xAC";
+                    if (*shared.conv(value) != utf::conv<char32_t>(value))
+                        ++failures;
+                }
+            });
+    for (auto & thread : threads)
+        thread.join();
+    BOOST_TEST(failures == 0u);
+    auto const shared_stats = shared.stats();
+    BOOST_TEST(shared_stats.hits + shared_stats.misses == 8000u);
+}
+
+namespace {
+
+template<
+    typename Och,
+    typename Ch>
+void run_in_place_test(std::basic_string<Ch> storage)
+{
+    auto const expected = utf::conv<Och>(storage);
+    auto const size = utf::conv_in_place<Och>(storage);
+    BOOST_TEST_REQUIRE(size == expected.size());
+    BOOST_TEST_REQUIRE(storage.size() * sizeof(Ch) >= size * sizeof(Och));
+    BOOST_TEST_REQUIRE(storage.size() * sizeof(Ch) < size * sizeof(Och) + sizeof(Ch));
+    std::basic_string<Och> res(size, 0);
+    if (size != 0)
+        std::memcpy(&res[0], storage.data(), size * sizeof(Och));
+    BOOST_TEST_REQUIRE((res == expected));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(conv_in_place)
+{
+    // Note: The long texts take many chunks, the growing ones go through the tail.
+    std::u32string const pieces[] = { U"ascii ", U"\u0434\u043E\u043C ", U"\u4E00\u4E8C ", U"\U0001F600 " };
+    for (auto const & piece : pieces)
+        for (size_t count : {0, 1, 3, 1000})
+        {
+            std::u32string u32;
+            for (size_t n = 0; n < count; ++n)
+                u32 += pieces[n % 4] + piece;
+            run_in_place_test<char>(u32);
+            run_in_place_test<char16_t>(u32);
+            run_in_place_test<char>(utf::conv<char16_t>(u32));
+            run_in_place_test<char32_t>(utf::conv<char16_t>(u32));
+            run_in_place_test<char16_t>(utf::conv<char>(u32));
+            run_in_place_test<char32_t>(utf::conv<char>(u32));
+        }
+    std::u16string invalid(u"ab");
+    invalid.push_back(0xDC00);
+    BOOST_CHECK_THROW(utf::conv_in_place<char>(invalid), std::runtime_error);
+    BOOST_TEST(invalid.size() == 3u);
+}
+
+namespace {
+
+template<
+    typename Ch>
+void run_fanout_test(std::u32string const & u32)
+{
+    auto const str = utf::conv<Ch>(u32);
+    std::string u8(1, 'x');
+    std::u16string u16;
+    std::u32string res;
+    std::wstring wstr;
+    utf::conv_fanout(str, u8, u16, res, wstr);
+    BOOST_TEST_REQUIRE((u8 == 'x' + utf::conv<char>(u32)));
+    BOOST_TEST_REQUIRE((u16 == utf::conv<char16_t>(u32)));
+    BOOST_TEST_REQUIRE((res == u32));
+    BOOST_TEST_REQUIRE((wstr == utf::conv<wchar_t>(u32)));
+    typedef utf::utf_selector_t<Ch> utf_type;
+    std::list<Ch> const list(str.cbegin(), str.cend());
+    std::u16string list_u16;
+    std::u32string list_u32;
+    utf::conv_fanout<utf_type, utf::utf16, utf::utf32>(
+        list.cbegin(), list.cend(), std::back_inserter(list_u16), std::back_inserter(list_u32));
+    BOOST_TEST_REQUIRE((list_u16 == u16));
+    BOOST_TEST_REQUIRE((list_u32 == u32));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(conv_fanout)
+{
+    // Note: The long texts take many chunks, the ASCII ones are converted from the input.
+    std::u32string const pieces[] = { U"ascii ", U"\u0434\u043E\u043C ", U"\u4E00\u4E8C ", U"\U0001F600 " };
+    for (auto const & piece : pieces)
+        for (size_t count : {0, 1, 3, 1000})
+        {
+            std::u32string u32;
+            for (size_t n = 0; n < count; ++n)
+                u32 += piece + pieces[n % 4];
+            std::u32string ascii;
+            for (size_t n = 0; n < count; ++n)
+                ascii += U"abc ";
+            for (auto const & text : {u32, ascii})
+            {
+                run_fanout_test<char    >(text);
+                run_fanout_test<char16_t>(text);
+                run_fanout_test<char32_t>(text);
+            }
+        }
+    std::string invalid(3000, 'a');
+    invalid += "\xC3";
+    std::u16string u16;
+    std::u32string u32;
+    BOOST_CHECK_THROW(utf::conv_fanout(invalid, u16, u32), std::runtime_error);
+    BOOST_TEST(u16.size() == u32.size());
+
+    // Note: The surrogate and the 5 byte symbol are decoded by utf8 and taken by utf32 but not by utf16, so the chunk
+    //       isn't written to any output.
+    for (auto const & unencodable : { std::string("ab\xED\xA0\x80"), std::string("ab\xF8\x88\x80\x80\x80") })
+    {
+        std::list<char> const list(unencodable.cbegin(), unencodable.cend());
+        for (auto const random_access : { false, true })
+        {
+            std::u32string u32_out;
+            std::u16string u16_out;
+            if (random_access)
+                BOOST_CHECK_THROW((utf::conv_fanout<utf::utf8, utf::utf32, utf::utf16>(
+                    unencodable.data(), unencodable.data() + unencodable.size(),
+                    std::back_inserter(u32_out), std::back_inserter(u16_out))), std::runtime_error);
+            else
+                BOOST_CHECK_THROW((utf::conv_fanout<utf::utf8, utf::utf32, utf::utf16>(
+                    list.cbegin(), list.cend(),
+                    std::back_inserter(u32_out), std::back_inserter(u16_out))), std::runtime_error);
+            BOOST_TEST(u32_out.empty());
+            BOOST_TEST(u16_out.empty());
+        }
+    }
+}
+
+namespace {
+
+// Note: The zero threshold takes the streaming for any input, the output is shifted to start at every offset of the
+//       16 byte blocks.
+template<
+    typename Ch,
+    typename Och>
+void run_streaming_test(std::u32string const & u32)
+{
+    typedef utf::utf_selector_t<Ch > utf_type;
+    typedef utf::utf_selector_t<Och> outf_type;
+    auto const str = utf::conv<Ch>(u32);
+    auto const expected = utf::conv<Och>(u32);
+    for (size_t shift = 0; shift < 16 / sizeof(Och); ++shift)
+    {
+        std::vector<Och> res(expected.size() + shift + 1, 0);
+        auto const optr = res.data() + shift;
+        for (auto const threshold : { size_t(0), utf::default_streaming_threshold })
+        {
+            auto const oend = utf::conv_streaming<utf_type, outf_type>(str.data(), str.data() + str.size(), optr, threshold);
+            BOOST_TEST_REQUIRE(static_cast<size_t>(oend - optr) == expected.size());
+            BOOST_TEST_REQUIRE(std::equal(expected.cbegin(), expected.cend(), optr));
+        }
+        BOOST_TEST_REQUIRE(res.back() == 0);
+    }
+}
+
+template<
+    typename Ch>
+void run_streaming_test_from(std::u32string const & u32)
+{
+    run_streaming_test<Ch, char    >(u32);
+    run_streaming_test<Ch, char16_t>(u32);
+    run_streaming_test<Ch, char32_t>(u32);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(conv_streaming)
+{
+    // Note: The long texts take many chunks, the remainder of every chunk waits for the next one.
+    std::u32string const pieces[] = { U"ascii ", U"\u0434\u043E\u043C ", U"\u4E00\u4E8C ", U"\U0001F600 " };
+    for (auto const & piece : pieces)
+        for (size_t count : {0, 1, 3, 5000})
+        {
+            std::u32string u32;
+            for (size_t n = 0; n < count; ++n)
+                u32 += piece + pieces[n % 4];
+            run_streaming_test_from<char    >(u32);
+            run_streaming_test_from<char16_t>(u32);
+            run_streaming_test_from<char32_t>(u32);
+        }
+    std::string invalid(50000, 'a');
+    invalid += "\xC3";
+    std::u16string res(invalid.size(), 0);
+    BOOST_CHECK_THROW((utf::conv_streaming<utf::utf8, utf::utf16>(invalid.data(), invalid.data() + invalid.size(), &res[0], 0)), std::runtime_error);
+}
+
+namespace {
+
+// Note: The list iterators take the normal strategy which converts symbol by symbol, it is the reference.
+template<
+    typename Ch,
+    typename Och>
+void run_unit_block_test(std::basic_string<Ch> const & str)
+{
+    typedef utf::utf_selector_t<Ch > utf_type;
+    typedef utf::utf_selector_t<Och> outf_type;
+    std::list<Ch> const list(str.cbegin(), str.cend());
+    std::basic_string<Och> expected;
+    utf::conv<utf_type, outf_type>(list.cbegin(), list.cend(), std::back_inserter(expected));
+    std::basic_string<Och> res;
+    utf::conv<utf_type, outf_type>(str.data(), str.data() + str.size(), std::back_inserter(res));
+    BOOST_TEST_REQUIRE((res == expected));
+    std::basic_string<Och> buf(expected.size(), 0);
+    BOOST_TEST_REQUIRE((utf::conv<utf_type, outf_type>(str.data(), str.data() + str.size(), &buf[0]) == &buf[0] + buf.size()));
+    BOOST_TEST_REQUIRE((buf == expected));
+    std::basic_string<Och> unchecked(expected.size(), 0);
+    BOOST_TEST_REQUIRE((utf::conv_unchecked<utf_type, outf_type>(str.data(), str.data() + str.size(), &unchecked[0]) == &unchecked[0] + unchecked.size()));
+    BOOST_TEST_REQUIRE((unchecked == expected));
+}
+
+template<
+    typename Ch>
+void run_unit_block_test_from(std::u32string const & u32)
+{
+    auto const str = utf::conv<Ch>(u32);
+    run_unit_block_test<Ch, char    >(str);
+    run_unit_block_test<Ch, char16_t>(str);
+    run_unit_block_test<Ch, char32_t>(str);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(conv_unit_blocks)
+{
+    // Note: The runs of ASCII, BMP and supplementary code points of random lengths cross the block borders everywhere.
+    static uint32_t const limits[] = { 0x80, 0x800, 0xD800, 0x10000, 0x110000 };
+    boost::random::mt19937 random(0);
+    for (size_t n = 0; n < 200; ++n)
+    {
+        std::u32string u32;
+        for (auto runs = random() % 8; runs-- > 0; )
+        {
+            auto const limit = limits[random() % (sizeof(limits) / sizeof(limits[0]))];
+            for (auto size = random() % 40; size-- > 0; )
+            {
+                auto cp = random() % limit;
+                if (utf::is_surrogate(cp))
+                    cp -= utf::min_surrogate;
+                u32.push_back(cp);
+            }
+        }
+        run_unit_block_test_from<char    >(u32);
+        run_unit_block_test_from<char16_t>(u32);
+        run_unit_block_test_from<char32_t>(u32);
+    }
+    // Note: The last block ends exactly at the end of the input after the symbols converted one by one.
+    for (size_t size = 0; size <= 40; ++size)
+    {
+        std::u32string u32(3, 0x0430);
+        u32.append(size, 'a');
+        run_unit_block_test_from<char    >(u32);
+        run_unit_block_test_from<char16_t>(u32);
+        run_unit_block_test_from<char32_t>(u32);
+    }
+    std::u32string u32(40, 'a');
+    u32[20] = 0xD800;
+    std::u16string u16;
+    BOOST_CHECK_THROW((utf::conv<utf::utf16>(u32, std::back_inserter(u16))), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(conv_unchecked_verify)
+{
+    std::string const valid("a\xD0\xB0\xF0\x9F\x98\x80");
+    std::string const truncated("a\xF0\x9F\x98");
+    std::u32string const surrogate(1, 0xD800);
+    BOOST_TEST_REQUIRE((utf::detail::is_convertible<utf::utf8, utf::utf16>(valid.cbegin(), valid.cend(), std::true_type())));
+    BOOST_TEST_REQUIRE((!utf::detail::is_convertible<utf::utf8, utf::utf16>(truncated.cbegin(), truncated.cend(), std::true_type())));
+    BOOST_TEST_REQUIRE((!utf::detail::is_convertible<utf::utf32, utf::utf16>(surrogate.cbegin(), surrogate.cend(), std::true_type())));
+    BOOST_TEST_REQUIRE((utf::conv_unchecked<char16_t>(valid) == utf::conv<char16_t>(valid)));
+}
+
+BOOST_AUTO_TEST_CASE(conv_counters)
+{
+    utf::reset_counters<utf::utf16, utf::utf8>();
+    // Note: The 32 ASCII symbols take the blocks and the rest is decoded by the symbols, the unchecked conversion is
+    //       counted for the same pair.
+    std::u16string const u16(u"0123456789abcdef0123456789abcdef" u"aа一\U0001F600");
+    auto const u8 = utf::conv<char>(u16);
+    BOOST_TEST_REQUIRE((utf::conv_unchecked<char>(u16) == u8));
+    BOOST_CHECK_THROW(utf::conv<char>(std::u16string(1, 0xD800)), std::runtime_error);
+    auto const counters = utf::reset_counters<utf::utf16, utf::utf8>();
+    BOOST_TEST_REQUIRE((utf::counters<utf::utf16, utf::utf8>().input_bytes == 0u));
+#if defined(WW898_UTF_COUNTERS)
+    BOOST_TEST_REQUIRE(counters.input_bytes == 2 * sizeof(char16_t) * u16.size());
+    BOOST_TEST_REQUIRE(counters.output_bytes == 2 * u8.size());
+    BOOST_TEST_REQUIRE(counters.simd_code_points + counters.scalar_code_points == 2 * 36u);
+    BOOST_TEST_REQUIRE(counters.symbols[0] == 2 * 33u);
+    BOOST_TEST_REQUIRE(counters.symbols[1] == 2u);
+    BOOST_TEST_REQUIRE(counters.symbols[2] == 2u);
+    BOOST_TEST_REQUIRE(counters.symbols[3] == 2u);
+    BOOST_TEST_REQUIRE(counters.errors == 1u);
+#if defined(WW898_UTF_SSE2)
+    BOOST_TEST_REQUIRE(counters.simd_code_points == 2 * 32u);
+#endif
+#else
+    BOOST_TEST_REQUIRE(counters.input_bytes == 0u);
+    BOOST_TEST_REQUIRE(counters.errors == 0u);
+#endif
+
+    // Note: The JSON codecs escape the symbols, so their conversions are not counted.
+    std::list<char16_t> const list(u16.cbegin(), u16.cend());
+    std::string json;
+    utf::conv<utf::utf16, utf::utf8_json>(list.cbegin(), list.cend(), std::back_inserter(json));
+    utf::convz<utf::utf8_json_ascii>(u"\"quoted\"", std::back_inserter(json));
+    BOOST_TEST_REQUIRE((json == utf::conv<char>(u16) + "\\\"quoted\\\""));
+    BOOST_TEST_REQUIRE((utf::counters<utf::utf16, utf::utf8_json>().input_bytes == 0u));
+    BOOST_TEST_REQUIRE((utf::counters<utf::utf16, utf::utf8_json_ascii>().input_bytes == 0u));
+}
+
+BOOST_AUTO_TEST_CASE(conv_contiguous)
+{
+    static_assert(utf::detail::is_contiguous_iterator<std::vector<char16_t>::iterator>::value, "Fail");
+    static_assert(utf::detail::is_contiguous_iterator<std::string::const_iterator>::value, "Fail");
+    static_assert(!utf::detail::is_contiguous_iterator<std::list<char>::const_iterator>::value, "Fail");
+    static_assert(!utf::detail::is_contiguous_iterator<std::vector<bool>::const_iterator>::value, "Fail");
+    static_assert(!utf::detail::is_contiguous_iterator<char const *>::value, "Fail");
+    static_assert(utf::detail::is_contiguous_back_inserter<std::back_insert_iterator<std::u16string>>::value, "Fail");
+    static_assert(!utf::detail::is_contiguous_back_inserter<std::back_insert_iterator<std::list<char>>>::value, "Fail");
+
+    // Note: The output is longer than the append buffer, so it is appended by many chunks split inside the symbols.
+    std::u32string u32;
+    for (size_t n = 0; n < 10000; ++n)
+        u32.push_back(n % 7 == 0 ? 0x1F600 + n % 50 : n % 3 == 0 ? 0x0430 + n % 32 : 'a' + n % 26);
+    std::list<char32_t> const list(u32.cbegin(), u32.cend());
+    std::string expected("prefix");
+    utf::conv<utf::utf32, utf::utf8>(list.cbegin(), list.cend(), std::back_inserter(expected));
+
+    auto u8 = std::string("prefix");
+    utf::conv<utf::utf32, utf::utf8>(u32.cbegin(), u32.cend(), std::back_inserter(u8));
+    BOOST_TEST_REQUIRE((u8 == expected));
+    std::vector<char> vec(expected.cbegin(), expected.cbegin() + 6);
+    utf::conv<utf::utf32, utf::utf8>(u32.cbegin(), u32.cend(), std::back_inserter(vec));
+    BOOST_TEST_REQUIRE((std::string(vec.cbegin(), vec.cend()) == expected));
+
+    std::vector<char16_t> u16(u32.size() * 2 + 1, u'x');
+    auto const u16_end = utf::conv<utf::utf8, utf::utf16>(u8.cbegin() + 6, u8.cend(), u16.begin());
+    BOOST_TEST_REQUIRE((utf::conv<char32_t>(std::u16string(u16.begin(), u16_end)) == u32));
+    BOOST_TEST_REQUIRE((*u16_end == u'x'));
+    BOOST_TEST_REQUIRE((utf::conv<utf::utf8, utf::utf16>(u8.cend(), u8.cend(), u16.begin()) == u16.begin()));
+    BOOST_TEST_REQUIRE((utf::size<utf::utf16>(u16.begin(), u16_end) == static_cast<size_t>(u16_end - u16.begin())));
+    BOOST_TEST_REQUIRE((utf::size<utf::utf16>(u16.begin(), u16.begin()) == 0));
+
+    std::u16string u16z;
+    utf::convz<utf::utf8, utf::utf16>(u8.cbegin() + 6, std::back_inserter(u16z));
+    BOOST_TEST_REQUIRE((utf::conv<char32_t>(u16z) == u32));
+
+    auto const invalid = u8 + '\xF0';
+    std::u16string res;
+    BOOST_CHECK_THROW((utf::conv<utf::utf8, utf::utf16>(invalid.cbegin(), invalid.cend(), std::back_inserter(res))), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(complete_end)
+{
+    std::string const u8{ '\x61', '\xE2', '\x82', '\xAC', '\xF0', '\x90', '\x8D' };
+    BOOST_TEST_REQUIRE((utf::complete_end<utf::utf8>(u8.cbegin(), u8.cend()) == u8.cbegin() + 4));
+    BOOST_TEST_REQUIRE((utf::complete_end<utf::utf8>(u8.cbegin(), u8.cbegin() + 4) == u8.cbegin() + 4));
+    BOOST_TEST_REQUIRE((utf::complete_end<utf::utf8>(u8.cbegin(), u8.cbegin() + 3) == u8.cbegin() + 1));
+    std::u16string const u16{ 0x0061, 0xD800, 0xDF48, 0xD800 };
+    BOOST_TEST_REQUIRE((utf::complete_end<utf::utf16>(u16.cbegin(), u16.cend()) == u16.cbegin() + 3));
+    BOOST_TEST_REQUIRE((utf::complete_end<utf::utf16>(u16.cbegin(), u16.cbegin() + 3) == u16.cbegin() + 3));
+}
+
+BOOST_AUTO_TEST_CASE(compare_invalid)
+{
+    std::string const u8{ '\x61', '\xE2', '\x82' };
+    std::u16string const u16{ 0x0061, 0x20AC };
+    BOOST_CHECK_THROW(utf::compare(u8, u16), std::runtime_error);
+}
+
 BOOST_STATIC_ASSERT(utf::is_utf_same<unsigned char,          char>::value);
 BOOST_STATIC_ASSERT(utf::is_utf_same<unsigned char, unsigned char>::value);
 BOOST_STATIC_ASSERT(utf::is_utf_same<unsigned char, signed   char>::value);
@@ -577,6 +1667,159 @@ BOOST_STATIC_ASSERT( utf::is_utf_same_v<wchar_t, char32_t>);
 
 namespace {
 
+std::string make_streambuf_test_data()
+{
+    std::string u8;
+    for (size_t n = 0; n < 8; ++n)
+        for (auto const & tuple : unicode_test_data)
+            u8 += tuple.u8;
+    return u8;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(transcoding_streambuf_read)
+{
+    auto const u8 = make_streambuf_test_data();
+    for (auto const block_size : { size_t(6), size_t(7), size_t(64), utf::transcoding_streambuf_u16::default_block_size })
+    {
+        std::stringbuf buf(u8);
+        utf::transcoding_streambuf_u16 tbuf(&buf, block_size);
+        std::u16string u16;
+        char16_t tmp[37];
+        for (std::streamsize size; (size = tbuf.sgetn(tmp, sizeof(tmp) / sizeof(*tmp))) > 0;)
+            u16.append(tmp, static_cast<size_t>(size));
+        BOOST_TEST_REQUIRE((u16 == utf::conv<char16_t>(u8)));
+    }
+
+    {
+        std::stringbuf buf(u8);
+        utf::transcoding_streambuf_w tbuf(&buf, 11);
+        std::wistream is(&tbuf);
+        std::wstring const uw((std::istreambuf_iterator<wchar_t>(is)), std::istreambuf_iterator<wchar_t>());
+        BOOST_TEST_REQUIRE((uw == utf::conv<wchar_t>(u8)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(transcoding_streambuf_write)
+{
+    auto const u8 = make_streambuf_test_data();
+    auto const uw = utf::conv<wchar_t>(u8);
+    for (auto const block_size : { size_t(6), size_t(7), size_t(64), utf::transcoding_streambuf_w::default_block_size })
+    {
+        std::stringbuf buf;
+        {
+            utf::transcoding_streambuf_w tbuf(&buf, block_size);
+            std::wostream os(&tbuf);
+            os << uw;
+        }
+        BOOST_TEST_REQUIRE((buf.str() == u8));
+    }
+
+    {
+        std::stringbuf buf;
+        utf::transcoding_streambuf_u16 tbuf(&buf, 8);
+        auto const u16 = utf::conv<char16_t>(u8);
+        for (auto const ch : u16)
+            tbuf.sputc(ch);
+        BOOST_TEST_REQUIRE(tbuf.pubsync() == 0);
+        BOOST_TEST_REQUIRE((buf.str() == u8));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(transcoding_streambuf_invalid)
+{
+    std::stringbuf buf(std::string{ '\x61', '\xE2', '\x82' });
+    utf::transcoding_streambuf_u32 tbuf(&buf, 8);
+    BOOST_TEST_REQUIRE((tbuf.sbumpc() == 0x61));
+    BOOST_CHECK_THROW(tbuf.sbumpc(), std::runtime_error);
+    BOOST_CHECK_THROW(utf::transcoding_streambuf_u32(&buf, 2), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(conv_pipeline)
+{
+    auto const u8 = make_streambuf_test_data();
+    auto const u16 = utf::conv<char16_t>(u8);
+    for (auto const worker_count : { size_t(1), size_t(3) })
+        for (auto const block_size : { size_t(6), size_t(7), size_t(64), utf::default_pipeline_block_size })
+        {
+            std::stringbuf ibuf(u8);
+            std::basic_stringbuf<char16_t> obuf;
+            utf::conv_pipeline<utf::utf8, utf::utf16>(ibuf, obuf, worker_count, block_size);
+            BOOST_TEST_REQUIRE((obuf.str() == u16));
+        }
+
+    {
+        std::basic_stringbuf<char16_t> ibuf(u16);
+        std::stringbuf obuf;
+        utf::conv_pipeline<utf::utf16, utf::utf8>(ibuf, obuf);
+        BOOST_TEST_REQUIRE((obuf.str() == u8));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(conv_pipeline_invalid)
+{
+    for (auto const & u8 : { std::string{ '\x61', '\xE2', '\x82' }, std::string{ '\x61', '\x82', '\x61' } })
+    {
+        std::stringbuf ibuf(make_streambuf_test_data() + u8);
+        std::basic_stringbuf<char32_t> obuf;
+        BOOST_CHECK_THROW((utf::conv_pipeline<utf::utf8, utf::utf32>(ibuf, obuf, 2, 16)), std::runtime_error);
+    }
+    std::stringbuf ibuf;
+    std::basic_stringbuf<char32_t> obuf;
+    BOOST_CHECK_THROW((utf::conv_pipeline<utf::utf8, utf::utf32>(ibuf, obuf, 0)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(conv_batch)
+{
+    std::vector<std::u16string> u16s;
+    std::vector<std::string> u8s;
+    for (auto const & tuple : unicode_test_data)
+    {
+        u16s.push_back(tuple.u16);
+        u8s.push_back(tuple.u8);
+    }
+    u16s.emplace_back();
+    u8s.emplace_back();
+
+    auto const column = utf::conv_batch<char>(u16s.cbegin(), u16s.cend());
+    BOOST_TEST_REQUIRE(column.size() == u8s.size());
+    BOOST_TEST_REQUIRE(column.offsets.front() == 0);
+    BOOST_TEST_REQUIRE(column.offsets.back() == column.data.size());
+    for (size_t n = 0; n < u8s.size(); ++n)
+        BOOST_TEST_REQUIRE((column.str(n) == u8s[n]));
+
+    // Note: The column is reused as the Arrow style input.
+    utf::basic_string_column<char32_t> u32_column;
+    utf::conv_batch<utf::utf8, utf::utf32>(column.offsets.data(), column.size(), column.data.data(), u32_column);
+    utf::conv_batch<utf::utf8, utf::utf32>(column.offsets.data(), column.size(), column.data.data(), u32_column);
+    BOOST_TEST_REQUIRE(u32_column.size() == 2 * u8s.size());
+    for (size_t n = 0; n < u32_column.size(); ++n)
+        BOOST_TEST_REQUIRE((u32_column.str(n) == utf::conv<char32_t>(u8s[n % u8s.size()])));
+
+    auto const same = utf::conv_batch<char>(u8s.cbegin(), u8s.cend());
+    BOOST_TEST_REQUIRE((same.data == column.data && same.offsets == column.offsets));
+
+    // Note: The ASCII column takes one code unit per input code unit, the place for the longer symbols is not kept.
+    std::vector<std::u16string> const ascii(1000, u"value");
+    auto const ascii_column = utf::conv_batch<char>(ascii.cbegin(), ascii.cend());
+    BOOST_TEST_REQUIRE(ascii_column.data.size() == 5000u);
+    BOOST_TEST(ascii_column.data.capacity() <= ascii_column.data.size() + ascii_column.data.size() / 8);
+}
+
+BOOST_AUTO_TEST_CASE(conv_batch_invalid)
+{
+    std::vector<std::string> const u8s = { "abc", std::string{ '\x61', '\xE2', '\x82' } };
+    utf::basic_string_column<char16_t> column;
+    utf::conv_batch<utf::utf8, utf::utf16>(u8s.cbegin(), u8s.cbegin() + 1, column);
+    BOOST_CHECK_THROW((utf::conv_batch<utf::utf8, utf::utf16>(u8s.cbegin(), u8s.cend(), column)), std::runtime_error);
+    BOOST_TEST_REQUIRE(column.size() == 1);
+    BOOST_TEST_REQUIRE((column.str(0) == u"abc"));
+    BOOST_TEST_REQUIRE(column.data.size() == 3);
+}
+
+namespace {
+
 uint64_t get_time() throw()
 {
 #if defined(_MSC_VER)
@@ -670,6 +1913,130 @@ uint64_t get_time_resolution() throw()
 #endif
 }
 
+// Note: Hardware counters are read with perf_event_open(2) on Linux only. The counters which can't be opened (no
+//       hardware support, kernel.perf_event_paranoid restrictions, containers) are silently skipped.
+class perf_counters final
+{
+public:
+    enum counter { cycles, instructions, branch_misses, l1d_misses, count };
+
+    perf_counters(perf_counters const &) = delete;
+    perf_counters & operator=(perf_counters const &) = delete;
+
+    perf_counters()
+    {
+        for (size_t n = 0; n < count; ++n)
+        {
+            fds_[n] = -1;
+            values_[n] = 0;
+        }
+#if defined(WW898_ENABLE_PERF_COUNTERS) && defined(__linux__)
+        static uint32_t const types[count] =
+        {
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE
+        };
+        static uint64_t const configs[count] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+        };
+        for (size_t n = 0; n < count; ++n)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[n];
+            attr.config = configs[n];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[n] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds_[n] < 0 && error_.empty())
+                error_ = std::string("perf_event_open: ") + strerror(errno);
+        }
+#elif defined(WW898_ENABLE_PERF_COUNTERS)
+        error_ = "not supported on the platform";
+#else
+        error_ = "disabled";
+#endif
+    }
+
+    ~perf_counters()
+    {
+#if defined(__linux__)
+        for (auto const fd : fds_)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    bool available(counter const index) const throw()
+    {
+        return fds_[index] >= 0;
+    }
+
+    bool available() const throw()
+    {
+        for (size_t n = 0; n < count; ++n)
+            if (available(static_cast<counter>(n)))
+                return true;
+        return false;
+    }
+
+    std::string const & error() const throw()
+    {
+        return error_;
+    }
+
+    uint64_t value(counter const index) const throw()
+    {
+        return values_[index];
+    }
+
+    void reset() throw()
+    {
+        for (auto & value : values_)
+            value = 0;
+    }
+
+    void start() throw()
+    {
+#if defined(__linux__)
+        for (auto const fd : fds_)
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+    }
+
+    void stop() throw()
+    {
+#if defined(__linux__)
+        for (size_t n = 0; n < count; ++n)
+            if (fds_[n] >= 0)
+                ioctl(fds_[n], PERF_EVENT_IOC_DISABLE, 0);
+        for (size_t n = 0; n < count; ++n)
+        {
+            uint64_t value;
+            if (fds_[n] >= 0 && read(fds_[n], &value, sizeof(value)) == sizeof(value))
+                values_[n] += value;
+        }
+#endif
+    }
+
+private:
+    int fds_[count];
+    uint64_t values_[count];
+    std::string error_;
+};
+
 size_t const warmup_iterations = 4;
 size_t const measure_iterations = 64;
 
@@ -677,16 +2044,24 @@ template<
     typename MeasureFn>
 double measure(
     uint64_t const resolution,
+    perf_counters & counters,
     MeasureFn && measure_fn)
 {
+    counters.reset();
     uint64_t sum_duration = 0;
     for (size_t n = 0; n < warmup_iterations + measure_iterations; ++n)
     {
+        auto const measured = n >= warmup_iterations;
+        if (measured)
+            counters.start();
         uint64_t const beg_time = get_time();
         measure_fn();
         uint64_t const end_time = get_time();
-        if (n >= warmup_iterations)
+        if (measured)
+        {
+            counters.stop();
             sum_duration += end_time - beg_time;
+        }
     }
     return static_cast<double>(sum_duration) / measure_iterations / resolution;
 }
@@ -714,6 +2089,30 @@ void dump_difference(double const duration, double const base_duration)
     std::cout << " (" << (percents > 0 ? "+" : "") << std::fixed << std::setprecision(2) << percents << "%)";
 }
 
+void dump_counters(perf_counters const & counters, size_t const bytes)
+{
+    if (!counters.available())
+        return;
+    auto const per_byte = [&] (perf_counters::counter const index)
+        {
+            return static_cast<double>(counters.value(index)) / measure_iterations / bytes;
+        };
+    auto const per_run = [&] (perf_counters::counter const index)
+        {
+            return counters.value(index) / measure_iterations;
+        };
+    std::cout << " [";
+    if (counters.available(perf_counters::cycles))
+        std::cout << std::fixed << std::setprecision(3) << per_byte(perf_counters::cycles) << " cycles/B ";
+    if (counters.available(perf_counters::instructions))
+        std::cout << std::fixed << std::setprecision(3) << per_byte(perf_counters::instructions) << " instructions/B ";
+    if (counters.available(perf_counters::branch_misses))
+        std::cout << per_run(perf_counters::branch_misses) << " branch-misses ";
+    if (counters.available(perf_counters::l1d_misses))
+        std::cout << per_run(perf_counters::l1d_misses) << " L1D-misses ";
+    std::cout << "]";
+}
+
 void dump_endl()
 {
     std::cout << std::endl;
@@ -724,6 +2123,7 @@ template<
     typename Och>
 double run_measure(
     uint64_t const resolution,
+    perf_counters & counters,
     std::vector<Ch> const & buf,
     std::vector<Och> const & obuf)
 {
@@ -732,7 +2132,7 @@ double run_measure(
 
     std::vector<Och> res;
     res.reserve(obuf.capacity());
-    auto const duration = measure(resolution, [&]
+    auto const duration = measure(resolution, counters, [&]
         {
             res.clear();
             utf::conv<utf_type, outf_type>(&buf.front(), &buf.back() + 1, std::back_inserter(res));
@@ -743,10 +2143,160 @@ double run_measure(
 
     dump_name<Ch, Och>();
     dump_duration(duration);
+    dump_counters(counters, sizeof(Ch) * buf.size());
     dump_endl();
     return duration;
 }
 
+// Note: Measures the conversion of the other library into the preallocated buffer. The input is null terminated for
+//       mbstowcs() and wcstombs(), the conversion function gives the size of the output or -1 on the error.
+template<
+    typename Ch,
+    typename Och,
+    typename ConvFn>
+void run_baseline(
+    uint64_t const resolution,
+    perf_counters & counters,
+    std::vector<Ch> const & buf,
+    std::vector<Och> const & obuf,
+    double const base_duration,
+    ConvFn && conv_fn)
+{
+    std::basic_string<Ch> const str(buf.cbegin(), buf.cend());
+    std::vector<Och> res(obuf.size() + 1);
+    size_t size = 0;
+    auto const duration = measure(resolution, counters, [&]
+        {
+            size = conv_fn(str.c_str(), str.size(), &res.front(), res.size());
+        });
+    BOOST_TEST_REQUIRE(size == obuf.size());
+    auto const same = memcmp(&obuf.front(), &res.front(), sizeof(Och) * obuf.size()) == 0;
+    BOOST_TEST_REQUIRE(same);
+
+    dump_name<Ch, Och>();
+    dump_duration(duration);
+    dump_difference(duration, base_duration);
+    dump_counters(counters, sizeof(Ch) * buf.size());
+    dump_endl();
+}
+
+// Note: Converts by std::codecvt::in() or std::codecvt::out() of the facet without std::wstring_convert.
+template<
+    typename Facet>
+struct codecvt_in final
+{
+    Facet const & facet;
+
+    size_t operator()(char const * const ptr, size_t const size, typename Facet::intern_type * const optr, size_t const osize) const
+    {
+        typename Facet::state_type state{};
+        char const * next;
+        typename Facet::intern_type * onext;
+        if (facet.in(state, ptr, ptr + size, next, optr, optr + osize, onext) != std::codecvt_base::ok || next != ptr + size)
+            return static_cast<size_t>(-1);
+        return onext - optr;
+    }
+};
+
+template<
+    typename Facet>
+struct codecvt_out final
+{
+    Facet const & facet;
+
+    size_t operator()(typename Facet::intern_type const * const ptr, size_t const size, char * const optr, size_t const osize) const
+    {
+        typename Facet::state_type state{};
+        typename Facet::intern_type const * next;
+        char * onext;
+        if (facet.out(state, ptr, ptr + size, next, optr, optr + osize, onext) != std::codecvt_base::ok || next != ptr + size)
+            return static_cast<size_t>(-1);
+        return onext - optr;
+    }
+};
+
+#if defined(__GLIBC__)
+// Note: The buffers are in the native byte order, the iconv names without the order would expect the BOM.
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+char const * const iconv_utf16 = "UTF-16BE";
+char const * const iconv_utf32 = "UTF-32BE";
+#else
+char const * const iconv_utf16 = "UTF-16LE";
+char const * const iconv_utf32 = "UTF-32LE";
+#endif
+
+class iconv_conv final
+{
+public:
+    iconv_conv(char const * const to, char const * const from)
+        : cd_(iconv_open(to, from))
+    {
+        if (cd_ == reinterpret_cast<iconv_t>(-1))
+            throw std::runtime_error(std::string("Failed to open iconv from ") + from + " to " + to);
+    }
+
+    iconv_conv(iconv_conv const &) = delete;
+    iconv_conv & operator=(iconv_conv const &) = delete;
+
+    ~iconv_conv()
+    {
+        iconv_close(cd_);
+    }
+
+    template<
+        typename Ch,
+        typename Och>
+    size_t operator()(Ch const * const ptr, size_t const size, Och * const optr, size_t const osize) const
+    {
+        iconv(cd_, nullptr, nullptr, nullptr, nullptr);
+        auto in = reinterpret_cast<char *>(const_cast<Ch *>(ptr));
+        auto out = reinterpret_cast<char *>(optr);
+        auto in_left = sizeof(Ch) * size;
+        auto out_left = sizeof(Och) * osize;
+        if (iconv(cd_, &in, &in_left, &out, &out_left) == static_cast<size_t>(-1) || in_left != 0)
+            return static_cast<size_t>(-1);
+        return osize - out_left / sizeof(Och);
+    }
+
+private:
+    iconv_t const cd_;
+};
+#endif
+
+// Note: Selects the UTF-8 locale for mbstowcs() and wcstombs() and restores the previous one.
+class utf8_ctype_locale final
+{
+public:
+    utf8_ctype_locale()
+        : prev_(std::setlocale(LC_CTYPE, nullptr))
+        , selected_(false)
+    {
+        for (auto const name : {"C.UTF-8", "C.utf8", "en_US.UTF-8"})
+            if (std::setlocale(LC_CTYPE, name) != nullptr)
+            {
+                selected_ = true;
+                break;
+            }
+    }
+
+    utf8_ctype_locale(utf8_ctype_locale const &) = delete;
+    utf8_ctype_locale & operator=(utf8_ctype_locale const &) = delete;
+
+    ~utf8_ctype_locale()
+    {
+        std::setlocale(LC_CTYPE, prev_.c_str());
+    }
+
+    bool selected() const throw()
+    {
+        return selected_;
+    }
+
+private:
+    std::string const prev_;
+    bool selected_;
+};
+
 }
 
 #if defined(WW898_ENABLE_PERFORMANCE_TESTS)
@@ -778,6 +2328,10 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
                 cp = 0xFEFF;
 #endif
 
+            // Note: mbstowcs() and wcstombs() stop at the null character.
+            if (cp == 0)
+                cp = 1;
+
             buf_u32.push_back(cp);
         }
         utf::conv<utf::utf32, utf::utf8 >(buf_u32.cbegin(), buf_u32.cend(), std::back_inserter(buf_u8 ));
@@ -794,22 +2348,25 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
     auto const resolution = get_time_resolution();
     std::cout << "Resolution: " << resolution << std::endl;
 
-                                 run_measure(resolution, buf_u8 , buf_u8 );
-    auto const u8_u16_duration = run_measure(resolution, buf_u8 , buf_u16);
-                                 run_measure(resolution, buf_u8 , buf_u32);
-    auto const u8_uw_duration  = run_measure(resolution, buf_u8 , buf_uw );
-    auto const u16_u8_duration = run_measure(resolution, buf_u16, buf_u8 );
-                                 run_measure(resolution, buf_u16, buf_u16);
-                                 run_measure(resolution, buf_u16, buf_u32);
-                                 run_measure(resolution, buf_u16, buf_uw );
-                                 run_measure(resolution, buf_u32, buf_u8 );
-                                 run_measure(resolution, buf_u32, buf_u16);
-                                 run_measure(resolution, buf_u32, buf_u32);
-                                 run_measure(resolution, buf_u32, buf_uw );
-    auto const uw_u8_duration  = run_measure(resolution, buf_uw , buf_u8 );
-                                 run_measure(resolution, buf_uw , buf_u16);
-                                 run_measure(resolution, buf_uw , buf_u32);
-                                 run_measure(resolution, buf_uw , buf_uw );
+    perf_counters counters;
+    std::cout << "Perf counters: " << (counters.available() ? "enabled" : counters.error()) << std::endl;
+
+                                 run_measure(resolution, counters, buf_u8 , buf_u8 );
+    auto const u8_u16_duration = run_measure(resolution, counters, buf_u8 , buf_u16);
+    auto const u8_u32_duration = run_measure(resolution, counters, buf_u8 , buf_u32);
+    auto const u8_uw_duration  = run_measure(resolution, counters, buf_u8 , buf_uw );
+    auto const u16_u8_duration = run_measure(resolution, counters, buf_u16, buf_u8 );
+                                 run_measure(resolution, counters, buf_u16, buf_u16);
+                                 run_measure(resolution, counters, buf_u16, buf_u32);
+                                 run_measure(resolution, counters, buf_u16, buf_uw );
+    auto const u32_u8_duration = run_measure(resolution, counters, buf_u32, buf_u8 );
+                                 run_measure(resolution, counters, buf_u32, buf_u16);
+                                 run_measure(resolution, counters, buf_u32, buf_u32);
+                                 run_measure(resolution, counters, buf_u32, buf_uw );
+    auto const uw_u8_duration  = run_measure(resolution, counters, buf_uw , buf_u8 );
+                                 run_measure(resolution, counters, buf_uw , buf_u16);
+                                 run_measure(resolution, counters, buf_uw , buf_u32);
+                                 run_measure(resolution, counters, buf_uw , buf_uw );
 
     {
 #if _MSC_VER >= 1900
@@ -830,7 +2387,7 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
 
         {
             std::string res;
-            auto const duration = measure(resolution, [&]
+            auto const duration = measure(resolution, counters, [&]
                 {
                     res = cvt.to_bytes(reinterpret_cast<char16_type const *>(&buf_u16.front()), reinterpret_cast<char16_type const *>(&buf_u16.back()) + 1);
                 });
@@ -841,12 +2398,13 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
             dump_name<char16_t, char>();
             dump_duration(duration);
             dump_difference(duration, u16_u8_duration);
+            dump_counters(counters, sizeof(char16_t) * buf_u16.size());
             dump_endl();
         }
 
         {
             std::basic_string<char16_type> res;
-            auto const duration = measure(resolution, [&] { res = cvt.from_bytes(&buf_u8.front(), &buf_u8.back() + 1); });
+            auto const duration = measure(resolution, counters, [&] { res = cvt.from_bytes(&buf_u8.front(), &buf_u8.back() + 1); });
             BOOST_TEST_REQUIRE(res.size() == buf_u16.size());
             auto const same = memcmp(&buf_u16.front(), &res.front(), sizeof(char16_t) * buf_u16.size()) == 0;
             BOOST_TEST_REQUIRE(same);
@@ -854,6 +2412,7 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
             dump_name<char, char16_t>();
             dump_duration(duration);
             dump_difference(duration, u8_u16_duration);
+            dump_counters(counters, buf_u8.size());
             dump_endl();
         }
     }
@@ -875,7 +2434,7 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
 
         {
             std::string res;
-            auto const duration = measure(resolution, [&] { res = cvt.to_bytes(&buf_uw.front(), &buf_uw.back() + 1); });
+            auto const duration = measure(resolution, counters, [&] { res = cvt.to_bytes(&buf_uw.front(), &buf_uw.back() + 1); });
             BOOST_TEST_REQUIRE(res.size() == buf_u8.size());
             auto const same = memcmp(&buf_u8.front(), &res.front(), buf_u8.size()) == 0;
             BOOST_TEST_REQUIRE(same);
@@ -883,12 +2442,13 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
             dump_name<wchar_t, char>();
             dump_duration(duration);
             dump_difference(duration, uw_u8_duration);
+            dump_counters(counters, sizeof(wchar_t) * buf_uw.size());
             dump_endl();
         }
 
         {
             std::wstring res;
-            auto const duration = measure(resolution, [&] { res = cvt.from_bytes(&buf_u8.front(), &buf_u8.back() + 1); });
+            auto const duration = measure(resolution, counters, [&] { res = cvt.from_bytes(&buf_u8.front(), &buf_u8.back() + 1); });
             BOOST_TEST_REQUIRE(res.size() == buf_uw.size());
             auto const same = memcmp(&buf_uw.front(), &res.front(), sizeof(wchar_t) * buf_uw.size()) == 0;
             BOOST_TEST_REQUIRE(same);
@@ -896,9 +2456,59 @@ BOOST_AUTO_TEST_CASE(performance, WW898_PERFORMANCE_TESTS_MODE)
             dump_name<char, wchar_t>();
             dump_duration(duration);
             dump_difference(duration, u8_uw_duration);
+            dump_counters(counters, buf_u8.size());
             dump_endl();
         }
     }
+
+#if !defined(_MSC_VER)
+    // Note: The std::codecvt<char16_t> facet fails to link with MSVC like above.
+    {
+        std::cout << "codecvt<char16_t>:" << std::endl;
+        typedef std::codecvt<char16_t, char, std::mbstate_t> facet_type;
+        auto const & facet = std::use_facet<facet_type>(std::locale::classic());
+        run_baseline(resolution, counters, buf_u16, buf_u8 , u16_u8_duration, codecvt_out<facet_type>{facet});
+        run_baseline(resolution, counters, buf_u8 , buf_u16, u8_u16_duration, codecvt_in <facet_type>{facet});
+    }
+
+    {
+        std::cout << "codecvt<char32_t>:" << std::endl;
+        typedef std::codecvt<char32_t, char, std::mbstate_t> facet_type;
+        auto const & facet = std::use_facet<facet_type>(std::locale::classic());
+        run_baseline(resolution, counters, buf_u32, buf_u8 , u32_u8_duration, codecvt_out<facet_type>{facet});
+        run_baseline(resolution, counters, buf_u8 , buf_u32, u8_u32_duration, codecvt_in <facet_type>{facet});
+    }
+#endif
+
+#if defined(__GLIBC__)
+    {
+        std::cout << "iconv:" << std::endl;
+        run_baseline(resolution, counters, buf_u16, buf_u8 , u16_u8_duration, iconv_conv("UTF-8", iconv_utf16));
+        run_baseline(resolution, counters, buf_u8 , buf_u16, u8_u16_duration, iconv_conv(iconv_utf16, "UTF-8"));
+        run_baseline(resolution, counters, buf_u32, buf_u8 , u32_u8_duration, iconv_conv("UTF-8", iconv_utf32));
+        run_baseline(resolution, counters, buf_u8 , buf_u32, u8_u32_duration, iconv_conv(iconv_utf32, "UTF-8"));
+    }
+#endif
+
+    {
+        std::cout << "wcstombs/mbstowcs:" << std::endl;
+        utf8_ctype_locale const locale;
+        if (!locale.selected())
+            std::cout << "No UTF-8 locale" << std::endl;
+        else
+        {
+            run_baseline(resolution, counters, buf_uw, buf_u8, uw_u8_duration,
+                [] (wchar_t const * const ptr, size_t, char * const optr, size_t const osize)
+                {
+                    return std::wcstombs(optr, ptr, osize);
+                });
+            run_baseline(resolution, counters, buf_u8, buf_uw, u8_uw_duration,
+                [] (char const * const ptr, size_t, wchar_t * const optr, size_t const osize)
+                {
+                    return std::mbstowcs(optr, ptr, osize);
+                });
+        }
+    }
 }
 
 BOOST_AUTO_TEST_CASE(example, WW898_PERFORMANCE_TESTS_MODE)
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+#
+# Generates include/ww898/utf_nfc_tables.hpp with the NFC_Quick_Check and Canonical_Combining_Class properties from the
+# Unicode database of the running Python:
+#
+#     python3 tools/gen_nfc_tables.py
+#
+# The NFC_Quick_Check is derived as UAX #15 defines it: No for the code points changed by NFC alone (the singletons,
+# the composition exclusions and the non-starter decompositions), Maybe for the second code points of the primary
+# composites and the Hangul V and T jamo.
+
+import os
+import unicodedata
+
+MAX_CODE_POINT = 0x10FFFF
+# Note: All code points below are NFC_Quick_Check=Yes with the combining class 0.
+MIN_CODE_POINT = 0x300
+QC_YES, QC_MAYBE, QC_NO = 0, 1, 2
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
+LICENSE_SOURCE = os.path.join(ROOT, 'include', 'ww898', 'utf_offsets.hpp')
+OUTPUT = os.path.join(ROOT, 'include', 'ww898', 'utf_nfc_tables.hpp')
+
+
+def quick_check():
+    qc = [QC_YES] * (MAX_CODE_POINT + 1)
+    for cp in range(MAX_CODE_POINT + 1):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        ch = chr(cp)
+        if unicodedata.normalize('NFC', ch) != ch:
+            qc[cp] = QC_NO
+    for cp in range(MAX_CODE_POINT + 1):
+        if qc[cp] != QC_YES:
+            continue
+        decomposition = unicodedata.decomposition(chr(cp))
+        if not decomposition or decomposition.startswith('<'):
+            continue
+        parts = [int(part, 16) for part in decomposition.split()]
+        if len(parts) == 2 and qc[parts[1]] != QC_NO:
+            qc[parts[1]] = QC_MAYBE
+    for cp in list(range(0x1161, 0x1176)) + list(range(0x11A8, 0x11C3)):
+        qc[cp] = QC_MAYBE
+    return qc
+
+
+def build():
+    qc = quick_check()
+    properties = []
+    property_index = {}
+    values = []
+    for cp in range(MAX_CODE_POINT + 1):
+        ccc = 0 if 0xD800 <= cp <= 0xDFFF else unicodedata.combining(chr(cp))
+        key = ccc | qc[cp] << 8
+        if key not in property_index:
+            property_index[key] = len(properties)
+            properties.append(key)
+        values.append(property_index[key])
+    assert properties[0] == 0 and len(properties) <= 256
+    assert all(value == 0 for value in values[:MIN_CODE_POINT])
+    last = max(cp for cp in range(MAX_CODE_POINT + 1) if values[cp])
+    shift, stage1, blocks = two_stage(values, last)
+    return properties, shift, stage1, blocks
+
+
+def two_stage(values, last, per_byte=1):
+    """Splits values[0..last] into the blocks of the size giving the smallest stage1 and stage2 tables, per_byte values
+    of stage2 share one byte."""
+    best = None
+    for shift in range(4, 10):
+        size = 1 << shift
+        blocks = []
+        block_index = {}
+        stage1 = []
+        for start in range(0, (last >> shift) + 1 << shift, size):
+            block = tuple(values[start:start + size])
+            if block not in block_index:
+                block_index[block] = len(blocks)
+                blocks.append(block)
+            stage1.append(block_index[block])
+        if len(blocks) > 256:
+            continue
+        total = len(stage1) + len(blocks) * size // per_byte
+        if best is None or total < best[0]:
+            best = (total, shift, stage1, blocks)
+    return best[1], best[2], best[3]
+
+
+def license_header():
+    with open(LICENSE_SOURCE, encoding='utf-8-sig') as source:
+        return ''.join(source.readlines()[:24])
+
+
+def format_rows(values, width, per_row):
+    rows = []
+    for start in range(0, len(values), per_row):
+        rows.append('    ' + ', '.join('{:>{}}'.format(value, width) for value in values[start:start + per_row]))
+    return ',\n'.join(rows)
+
+
+def main():
+    properties, shift, stage1, blocks = build()
+    license = license_header()
+    stage2 = [value for block in blocks for value in block]
+    with open(OUTPUT, 'w', encoding='utf-8-sig', newline='\n') as output:
+        output.write(license)
+        output.write('''\
+// Note: Generated by tools/gen_nfc_tables.py from the Unicode {version} database, don't edit.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ww898 {{
+namespace utf {{
+namespace detail {{
+
+// Note: The properties of the code point are looked up in two stages: the block of the code point, then the index of
+//       its properties in the block. The property is the combining class with the NFC_Quick_Check in the high byte:
+//       0 - Yes, 1 - Maybe, 2 - No. The code points out of [min_code_point‥max_code_point] have no properties.
+template<
+    typename = void>
+struct nfc_tables final
+{{
+    static uint32_t const min_code_point = 0x{min_code_point:X};
+    static uint32_t const max_code_point = 0x{max_code_point:X};
+    static size_t const block_shift = {shift};
+    static uint8_t const stage1[{stage1_size}];
+    static uint8_t const stage2[{stage2_size}];
+    static uint16_t const properties[{properties_size}];
+}};
+
+template<
+    typename T>
+uint8_t const nfc_tables<T>::stage1[{stage1_size}] =
+{{
+{stage1}
+}};
+
+template<
+    typename T>
+uint8_t const nfc_tables<T>::stage2[{stage2_size}] =
+{{
+{stage2}
+}};
+
+template<
+    typename T>
+uint16_t const nfc_tables<T>::properties[{properties_size}] =
+{{
+{properties}
+}};
+
+}}}}}}
+'''.format(
+            version=unicodedata.unidata_version,
+            min_code_point=MIN_CODE_POINT,
+            max_code_point=(len(stage1) << shift) - 1,
+            shift=shift,
+            stage1_size=len(stage1),
+            stage2_size=len(stage2),
+            properties_size=len(properties),
+            stage1=format_rows(stage1, 3, 20),
+            stage2=format_rows(stage2, 3, 20),
+            properties=format_rows(['0x{:03X}'.format(value) for value in properties], 5, 12)))
+
+
+if __name__ == '__main__':
+    main()
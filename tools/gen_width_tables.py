@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# Generates include/ww898/utf_width_tables.hpp with the terminal column widths of the code points from the Unicode
+# database of the running Python:
+#
+#     python3 tools/gen_width_tables.py
+#
+# The widths follow wcwidth(): 0 for the controls, the combining marks, the format characters (except the soft hyphen)
+# and the Hangul medial vowels and final consonants, 2 for the East Asian Wide and Fullwidth code points, 1 for the rest.
+
+import os
+import unicodedata
+
+from gen_nfc_tables import MAX_CODE_POINT, ROOT, format_rows, license_header, two_stage
+
+OUTPUT = os.path.join(ROOT, 'include', 'ww898', 'utf_width_tables.hpp')
+# Note: The unassigned code points are Wide only in these ranges of EastAsianWidth.txt, the unicodedata module doesn't
+#       give the default East_Asian_Width of the unassigned code points.
+WIDE_UNASSIGNED = ((0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF), (0x20000, 0x2FFFD), (0x30000, 0x3FFFD))
+
+
+def width(cp):
+    if 0xD800 <= cp <= 0xDFFF:
+        return 1
+    ch = chr(cp)
+    category = unicodedata.category(ch)
+    if category == 'Cc' or category in ('Mn', 'Me') or category == 'Cf' and cp != 0xAD or 0x1160 <= cp <= 0x11FF:
+        return 0
+    if category == 'Cn':
+        return 2 if any(first <= cp <= last for first, last in WIDE_UNASSIGNED) else 1
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return 2
+    return 1
+
+
+def main():
+    values = [width(cp) for cp in range(MAX_CODE_POINT + 1)]
+    # Note: The code points after the last block are width 1, so it is stored as zero to trim the tables.
+    stored = [(value + 2) % 3 for value in values]
+    last = max(cp for cp in range(MAX_CODE_POINT + 1) if stored[cp])
+    shift, stage1, blocks = two_stage(stored, last, 4)
+    stage2 = [value for block in blocks for value in block]
+    stage2 = [stage2[n] | stage2[n + 1] << 2 | stage2[n + 2] << 4 | stage2[n + 3] << 6 for n in range(0, len(stage2), 4)]
+    with open(OUTPUT, 'w', encoding='utf-8-sig', newline='\n') as output:
+        output.write(license_header())
+        output.write('''\
+// Note: Generated by tools/gen_width_tables.py from the Unicode {version} database, don't edit.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ww898 {{
+namespace utf {{
+namespace detail {{
+
+// Note: The column width of the code point is looked up in two stages: the block of the code point, then the width in
+//       the block. The widths are packed by 4 into the bytes of stage2 as (width + 2) % 3, so the code points after
+//       max_code_point are width 1.
+template<
+    typename = void>
+struct width_tables final
+{{
+    static uint32_t const max_code_point = 0x{max_code_point:X};
+    static size_t const block_shift = {shift};
+    static uint8_t const stage1[{stage1_size}];
+    static uint8_t const stage2[{stage2_size}];
+}};
+
+template<
+    typename T>
+uint8_t const width_tables<T>::stage1[{stage1_size}] =
+{{
+{stage1}
+}};
+
+template<
+    typename T>
+uint8_t const width_tables<T>::stage2[{stage2_size}] =
+{{
+{stage2}
+}};
+
+}}}}}}
+'''.format(
+            version=unicodedata.unidata_version,
+            max_code_point=(len(stage1) << shift) - 1,
+            shift=shift,
+            stage1_size=len(stage1),
+            stage2_size=len(stage2),
+            stage1=format_rows(stage1, 3, 20),
+            stage2=format_rows(stage2, 3, 20)))
+
+
+if __name__ == '__main__':
+    main()